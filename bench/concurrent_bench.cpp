@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "concurrent_stack.h"
+#include "stack.h"
+#include "logger.h"
+
+const size_t OPS_PER_THREAD = 1000000;
+const size_t MAX_THREADS = 32;
+
+struct Locked_stack {
+	std::mutex lock;
+	struct Stack stk;
+};
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+void run_concurrent(struct ConcurrentStack *stk);
+void run_locked(struct Locked_stack *locked);
+template <typename Stack_t>
+double measure(Stack_t *stk, void (*worker)(Stack_t*), size_t num_threads);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+void run_concurrent(struct ConcurrentStack *stk)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < OPS_PER_THREAD; i++) {
+		stack_push(stk, value);
+		stack_pop(stk, &value);
+	}
+}
+
+void run_locked(struct Locked_stack *locked)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < OPS_PER_THREAD; i++) {
+		locked->lock.lock();
+		stack_push(&locked->stk, value);
+		locked->lock.unlock();
+
+		locked->lock.lock();
+		stack_pop(&locked->stk, &value);
+		locked->lock.unlock();
+	}
+}
+
+template <typename Stack_t>
+double measure(Stack_t *stk, void (*worker)(Stack_t*), size_t num_threads)
+{
+	std::vector<std::thread> threads;
+	double start = now();
+
+	for (size_t i = 0; i < num_threads; i++)
+		threads.emplace_back(worker, stk);
+	for (size_t i = 0; i < num_threads; i++)
+		threads[i].join();
+
+	return (double) (2 * OPS_PER_THREAD * num_threads) / (now() - start) / 1e6;
+}
+
+int main()
+{
+	logger_ctor();
+
+	printf("threads,lock_free_mops,mutex_mops\n");
+	for (size_t num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+		struct ConcurrentStack cstk = {};
+		stack_ctor(&cstk);
+		double lock_free = measure(&cstk, run_concurrent, num_threads);
+		stack_dtor(&cstk);
+
+		struct Locked_stack *locked = new Locked_stack();
+		STACK_CTOR(&locked->stk, print_elem);
+		stack_set_validation(&locked->stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+		double mutex = measure(locked, run_locked, num_threads);
+		stack_dtor(&locked->stk);
+		delete locked;
+
+		printf("%lu,%.2lf,%.2lf\n", num_threads, lock_free, mutex);
+	}
+
+	logger_dtor();
+	return 0;
+}
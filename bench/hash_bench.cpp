@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "stack.h"
+
+const size_t HASH_BENCH_SIZES[] = { 16, 64, 1 << 10, 1 << 16, 1 << 20, 1 << 26 };
+const size_t HASH_BENCH_MIN_BYTES = (size_t) 1 << 28;
+
+typedef unsigned long (*hash_func)(const void *data_ptr, size_t size);
+
+unsigned long elem_slots_hash(const void *data_ptr, size_t size);
+
+struct Hash_algo {
+	const char *name;
+	hash_func hash;
+};
+
+// slots_hash goes through hash_bytes, so its row is for the hash this build uses:
+// hash_bench_djb2 is built with DJB2_HASH
+const struct Hash_algo HASH_ALGOS[] = {
+	{ "djb2",	gnu_hash  },
+	{ "word",	word_hash },
+	{ HASH_KIND == HASH_DJB2 ? "slots_djb2" : "slots_word", elem_slots_hash },
+};
+
+double now();
+double measure(const struct Hash_algo *algo, const unsigned char *data, size_t size,
+			   unsigned long *sink);
+
+// the whole data hash of a buffer of size / sizeof(elem_t) elements
+unsigned long elem_slots_hash(const void *data_ptr, size_t size)
+{
+	return slots_hash(data_ptr, sizeof(elem_t), 0, size / sizeof(elem_t));
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// returns GB/s; the sink keeps the calls from being optimized out
+double measure(const struct Hash_algo *algo, const unsigned char *data, size_t size,
+			   unsigned long *sink)
+{
+	size_t reps = HASH_BENCH_MIN_BYTES / size;
+	if (reps == 0)
+		reps = 1;
+
+	double start = now();
+	for (size_t rep = 0; rep < reps; rep++)
+		*sink += algo->hash(data, size);
+	double elapsed = now() - start;
+
+	return (double) (reps * size) / elapsed * 1e-9;
+}
+
+int main(int argc, const char *argv[])
+{
+	bool is_json = argc > 1 && strcmp(argv[1], "--json") == 0;
+	if (argc > 2 || (argc == 2 && !is_json)) {
+		fprintf(stderr, "usage: %s [--json]\n", argv[0]);
+		return 1;
+	}
+
+	size_t num_sizes = sizeof(HASH_BENCH_SIZES) / sizeof(HASH_BENCH_SIZES[0]);
+	size_t max_size = HASH_BENCH_SIZES[num_sizes - 1];
+
+	unsigned char *data = (unsigned char*) malloc(max_size);
+	if (data == NULL)
+		return 1;
+
+	unsigned state = 12345;
+	for (size_t i = 0; i < max_size; i++) {
+		state = state * 1103515245 + 12345;
+		data[i] = (unsigned char) (state >> 16);
+	}
+
+	unsigned long sink = 0;
+	if (!is_json)
+		printf("algo,size,gb_per_s\n");
+
+	for (size_t a = 0; a < sizeof(HASH_ALGOS) / sizeof(HASH_ALGOS[0]); a++) {
+		for (size_t s = 0; s < num_sizes; s++) {
+			double rate = measure(&HASH_ALGOS[a], data, HASH_BENCH_SIZES[s], &sink);
+			if (is_json)
+				printf("{\"algo\": \"%s\", \"size\": %zu, \"gb_per_s\": %.3lf}\n",
+					   HASH_ALGOS[a].name, HASH_BENCH_SIZES[s], rate);
+			else
+				printf("%s,%zu,%.3lf\n", HASH_ALGOS[a].name, HASH_BENCH_SIZES[s], rate);
+			fflush(stdout);
+		}
+	}
+
+	fprintf(stderr, "checksum %lx\n", sink);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack.h"
+#include "stack_debug.h"
+#include "logger.h"
+
+#ifndef HASH_PROTECTION
+#error "hash_update_bench measures HASH_PROTECTION builds"
+#endif
+
+const size_t BENCH_SIZES[] = { 1 << 10, 1 << 14, 1 << 18, 1 << 20, 1 << 22 };
+const size_t BENCH_PAIRS = 1 << 20;
+const size_t BENCH_MIN_REHASHES = 4;
+const double BENCH_MIN_SECONDS = 0.2;
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+double measure_push_pop(struct Stack *stk);
+double measure_rehash(struct Stack *stk);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// ns per push + pop pair; the incremental update touches one slot whatever the size
+double measure_push_pop(struct Stack *stk)
+{
+	elem_t value = {1.0, 1};
+
+	double start = now();
+	for (size_t i = 0; i < BENCH_PAIRS; i++) {
+		stack_push(stk, value);
+		stack_pop(stk, &value);
+	}
+
+	return (now() - start) * 1e9 / (double) BENCH_PAIRS;
+}
+
+// ns per full update_hash, what every push and pop used to cost
+double measure_rehash(struct Stack *stk)
+{
+	size_t rehashes = 0;
+
+	double start = now();
+	while (rehashes < BENCH_MIN_REHASHES || now() - start < BENCH_MIN_SECONDS) {
+		update_hash(stk);
+		rehashes++;
+	}
+
+	return (now() - start) * 1e9 / (double) rehashes;
+}
+
+int main(int argc, const char *argv[])
+{
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	logger_ctor();
+
+	printf("size,push_pop_ns,full_rehash_ns\n");
+
+	for (size_t s = 0; s < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); s++) {
+		struct Stack stk = {};
+		STACK_CTOR(&stk, print_elem);
+		stack_set_validation(&stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+
+		// reserved, so the pairs never grow or shrink the buffer
+		stack_reserve(&stk, BENCH_SIZES[s] + 1);
+		for (size_t i = 0; i < BENCH_SIZES[s]; i++)
+			stack_push(&stk, { (double) i, (int) i });
+
+		double push_pop = measure_push_pop(&stk);
+		double rehash = measure_rehash(&stk);
+		printf("%zu,%.1lf,%.0lf\n", BENCH_SIZES[s], push_pop, rehash);
+		fflush(stdout);
+
+		stack_dtor(&stk);
+	}
+
+	logger_dtor();
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stack.h"
+#include "journal.h"
+#include "logger.h"
+
+const size_t SYNC_EVERY[] = { 1, 4, 16, 64, 256, 1024 };
+const size_t JOURNAL_BENCH_SYNCS = 256;
+const size_t JOURNAL_BENCH_MIN_OPS = 1 << 14;
+const size_t PATH_SIZE = 512;
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+double measure(const char *path, size_t sync_every, size_t ops);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// pushes and pops alternate in pairs of runs, so the stack stays small
+double measure(const char *path, size_t sync_every, size_t ops)
+{
+	struct Stack stk = {};
+	struct Journal journal = {};
+	if (STACK_OPEN(&stk, print_elem, &journal, path, sync_every) != STACK_NO_ERR)
+		return -1;
+	stack_set_validation(&stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+
+	elem_t value = {1.0, 1};
+	double start = now();
+	for (size_t i = 0; i < ops; i++) {
+		if ((i / 64) % 2 == 0)
+			stack_push(&stk, value);
+		else
+			stack_pop(&stk, &value);
+	}
+	journal_commit(&journal);
+	double elapsed = now() - start;
+
+	stack_dtor(&stk);
+	journal_dtor(&journal);
+
+	return elapsed * 1e9 / (double) ops;
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : "/tmp";
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [directory]\n", argv[0]);
+		return 1;
+	}
+
+	char path[PATH_SIZE] = "";
+	snprintf(path, PATH_SIZE, "%s/journal_bench", dir);
+	char snap_path[PATH_SIZE] = "";
+	char wal_path[PATH_SIZE] = "";
+	snprintf(snap_path, PATH_SIZE, "%s.snap", path);
+	snprintf(wal_path, PATH_SIZE, "%s.wal", path);
+
+	logger_ctor();
+
+	printf("sync_every,ops,ns_per_op,ops_per_s\n");
+	for (size_t s = 0; s < sizeof(SYNC_EVERY) / sizeof(SYNC_EVERY[0]); s++) {
+		size_t ops = JOURNAL_BENCH_SYNCS * SYNC_EVERY[s];
+		if (ops < JOURNAL_BENCH_MIN_OPS)
+			ops = JOURNAL_BENCH_MIN_OPS;
+
+		unlink(snap_path);
+		unlink(wal_path);
+
+		double ns_per_op = measure(path, SYNC_EVERY[s], ops);
+		if (ns_per_op < 0) {
+			fprintf(stderr, "can't open a journal at %s\n", path);
+			return 1;
+		}
+
+		printf("%zu,%zu,%.1lf,%.0lf\n", SYNC_EVERY[s], ops, ns_per_op, 1e9 / ns_per_op);
+		fflush(stdout);
+	}
+
+	unlink(snap_path);
+	unlink(wal_path);
+
+	logger_dtor();
+	return 0;
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack.h"
+#include "logger.h"
+
+const size_t BENCH_OPS = 1 << 22;
+const size_t BENCH_BASE_SIZE = 1000;
+const size_t BENCH_BURST = 4096;
+const size_t BENCH_JITTER = 64;
+const size_t BENCH_DRAIN_PEAK = 1 << 20;
+
+struct Named_policy {
+	const char *name;
+	struct Stack_policy policy;
+};
+
+typedef size_t (*workload_func)(struct Stack *stk);
+
+struct Workload {
+	const char *name;
+	workload_func run;
+};
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+size_t run_boundary(struct Stack *stk);
+size_t run_burst(struct Stack *stk);
+size_t run_jitter(struct Stack *stk);
+size_t run_drain(struct Stack *stk);
+
+const struct Named_policy POLICIES[] = {
+	{ "double",		DEFAULT_POLICY },
+	{ "1.5x",		{ 1.5, 0, 0, GROW_GEOMETRIC, SHRINK_STEP } },
+	{ "inc64",		{ 0, 64, 0, GROW_INCREMENT, SHRINK_STEP } },
+	{ "never",		{ 2, 0, 0, GROW_GEOMETRIC, SHRINK_NEVER } },
+	{ "delayed",	{ 2, 0, 1 << 16, GROW_GEOMETRIC, SHRINK_DELAYED } },
+};
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------
+// every workload returns the number of operations it did
+
+// push/pop alternating right at a full buffer
+size_t run_boundary(struct Stack *stk)
+{
+	elem_t value = {1.0, 1};
+	while (stk->size < BENCH_BASE_SIZE || stk->size < stk->capacity)
+		stack_push(stk, value);
+
+	for (size_t i = 0; i < BENCH_OPS / 2; i++) {
+		stack_push(stk, value);
+		stack_pop(stk, &value);
+	}
+
+	return BENCH_OPS;
+}
+
+// fill up and drain to empty, over and over
+size_t run_burst(struct Stack *stk)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < BENCH_OPS / (2 * BENCH_BURST); i++) {
+		for (size_t j = 0; j < BENCH_BURST; j++)
+			stack_push(stk, value);
+		for (size_t j = 0; j < BENCH_BURST; j++)
+			stack_pop(stk, &value);
+	}
+
+	return BENCH_OPS;
+}
+
+// random walk within BENCH_JITTER elements of a base size
+size_t run_jitter(struct Stack *stk)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < BENCH_BASE_SIZE; i++)
+		stack_push(stk, value);
+
+	unsigned state = 12345;
+	for (size_t i = 0; i < BENCH_OPS; i++) {
+		state = state * 1103515245 + 12345;
+		bool is_push = (state >> 16) & 1;
+		if (stk->size <= BENCH_BASE_SIZE - BENCH_JITTER)
+			is_push = true;
+		else if (stk->size >= BENCH_BASE_SIZE + BENCH_JITTER)
+			is_push = false;
+
+		if (is_push)
+			stack_push(stk, value);
+		else
+			stack_pop(stk, &value);
+	}
+
+	return BENCH_OPS + BENCH_BASE_SIZE;
+}
+
+// one big peak, then a long steady phase at a small size
+size_t run_drain(struct Stack *stk)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < BENCH_DRAIN_PEAK; i++)
+		stack_push(stk, value);
+	while (stk->size > BENCH_BASE_SIZE)
+		stack_pop(stk, &value);
+
+	for (size_t i = 0; i < BENCH_OPS / 2; i++) {
+		stack_push(stk, value);
+		stack_pop(stk, &value);
+	}
+
+	return 2 * BENCH_DRAIN_PEAK - 2 * BENCH_BASE_SIZE + BENCH_OPS;
+}
+
+const struct Workload WORKLOADS[] = {
+	{ "boundary",	run_boundary	},
+	{ "burst",		run_burst		},
+	{ "jitter",		run_jitter		},
+	{ "drain",		run_drain		},
+};
+
+int main(int argc, const char *argv[])
+{
+	bool is_json = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			is_json = true;
+		else {
+			fprintf(stderr, "usage: %s [--json]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	logger_ctor();
+
+	if (!is_json)
+		printf("policy,workload,ns_per_op,grows,shrinks,bytes_moved,final_capacity\n");
+
+	for (size_t w = 0; w < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); w++) {
+		for (size_t p = 0; p < sizeof(POLICIES) / sizeof(POLICIES[0]); p++) {
+			struct Stack stk = {};
+			STACK_CTOR(&stk, print_elem);
+			stack_set_validation(&stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+			if (stack_set_policy(&stk, POLICIES[p].policy) != STACK_NO_ERR) {
+				fprintf(stderr, "bad policy %s\n", POLICIES[p].name);
+				return 1;
+			}
+
+			double start = now();
+			size_t ops = WORKLOADS[w].run(&stk);
+			double ns_per_op = (now() - start) * 1e9 / (double) ops;
+
+			struct Stack_stats stats = stack_stats(&stk);
+			if (is_json)
+				printf("{\"policy\": \"%s\", \"workload\": \"%s\", \"ns_per_op\": %.2lf, "
+					   "\"grows\": %zu, \"shrinks\": %zu, \"bytes_moved\": %zu, "
+					   "\"final_capacity\": %zu}\n", POLICIES[p].name, WORKLOADS[w].name,
+					   ns_per_op, stats.counters[STAT_GROWS], stats.counters[STAT_SHRINKS],
+					   stats.counters[STAT_BYTES_MOVED], stk.capacity);
+			else
+				printf("%s,%s,%.2lf,%zu,%zu,%zu,%zu\n", POLICIES[p].name, WORKLOADS[w].name,
+					   ns_per_op, stats.counters[STAT_GROWS], stats.counters[STAT_SHRINKS],
+					   stats.counters[STAT_BYTES_MOVED], stk.capacity);
+			fflush(stdout);
+
+			stack_dtor(&stk);
+		}
+	}
+
+	logger_dtor();
+	return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack.h"
+#include "persistent_stack.h"
+#include "logger.h"
+
+const size_t BENCH_SIZES[] = { 1000, 100000, 1000000 };
+const size_t BENCH_ROUNDS = 256;
+const size_t BENCH_HISTORY = 16;
+const size_t BENCH_UNDO_EVERY = 4;
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+double run_copying(size_t base_size, size_t *checksum);
+double run_persistent(size_t base_size, size_t *checksum, size_t *peak_nodes);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------
+// every round: snapshot into a BENCH_HISTORY ring, push 4, pop 2, and every
+// BENCH_UNDO_EVERY rounds roll back to the snapshot; returns ns per round
+
+double run_copying(size_t base_size, size_t *checksum)
+{
+	struct Stack stk = {};
+	STACK_CTOR(&stk, print_elem);
+	stack_set_validation(&stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+
+	for (size_t i = 0; i < base_size; i++)
+		stack_push(&stk, { (double) i, (int) i });
+
+	struct Stack history[BENCH_HISTORY] = {};
+	elem_t value = {1.0, 1};
+
+	double start = now();
+	for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+		struct Stack *snapshot = history + round % BENCH_HISTORY;
+		if (snapshot->data != NULL)
+			stack_dtor(snapshot);
+		STACK_CTOR(snapshot, print_elem);
+		stack_set_validation(snapshot, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+		stack_push_n(snapshot, stk.data, stk.size);
+
+		for (int i = 0; i < 4; i++)
+			stack_push(&stk, value);
+		stack_pop_n(&stk, NULL, 2);
+
+		if (round % BENCH_UNDO_EVERY == BENCH_UNDO_EVERY - 1) {
+			stack_dtor(&stk);
+			STACK_CTOR(&stk, print_elem);
+			stack_set_validation(&stk, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+			stack_push_n(&stk, snapshot->data, snapshot->size);
+		}
+	}
+	double elapsed = now() - start;
+
+	*checksum = stk.size;
+	for (size_t i = 0; i < BENCH_HISTORY; i++)
+		if (history[i].data != NULL)
+			stack_dtor(history + i);
+	stack_dtor(&stk);
+
+	return elapsed * 1e9 / (double) BENCH_ROUNDS;
+}
+
+double run_persistent(size_t base_size, size_t *checksum, size_t *peak_nodes)
+{
+	struct Pstack_pool pool = {};
+	pstack_pool_ctor(&pool, NULL);
+
+	struct PersistentStack stk = {};
+	PSTACK_CTOR(&stk, print_elem, &pool);
+
+	for (size_t i = 0; i < base_size; i++)
+		stack_push(&stk, { (double) i, (int) i });
+
+	struct PersistentStack history[BENCH_HISTORY] = {};
+	for (size_t i = 0; i < BENCH_HISTORY; i++)
+		PSTACK_CTOR(history + i, print_elem, &pool);
+
+	elem_t value = {1.0, 1};
+	*peak_nodes = 0;
+
+	double start = now();
+	for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+		struct PersistentStack *snapshot = history + round % BENCH_HISTORY;
+		stack_copy(snapshot, &stk);
+
+		for (int i = 0; i < 4; i++)
+			stack_push(&stk, value);
+		stack_pop(&stk, &value);
+		stack_pop(&stk, &value);
+
+		if (round % BENCH_UNDO_EVERY == BENCH_UNDO_EVERY - 1)
+			stack_copy(&stk, snapshot);
+
+		if (pool.live_nodes > *peak_nodes)
+			*peak_nodes = pool.live_nodes;
+	}
+	double elapsed = now() - start;
+
+	*checksum = stack_size(&stk);
+	for (size_t i = 0; i < BENCH_HISTORY; i++)
+		stack_dtor(history + i);
+	stack_dtor(&stk);
+
+	if (pstack_pool_dtor(&pool) != STACK_NO_ERR) {
+		fprintf(stderr, "nodes leaked\n");
+		exit(1);
+	}
+
+	return elapsed * 1e9 / (double) BENCH_ROUNDS;
+}
+
+int main(int argc, const char *argv[])
+{
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	logger_ctor();
+
+	printf("strategy,base_size,ns_per_round,final_size,peak_nodes\n");
+
+	for (size_t s = 0; s < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); s++) {
+		size_t copied_size = 0;
+		double ns_copying = run_copying(BENCH_SIZES[s], &copied_size);
+		printf("copy,%zu,%.0lf,%zu,\n", BENCH_SIZES[s], ns_copying, copied_size);
+
+		size_t persistent_size = 0;
+		size_t peak_nodes = 0;
+		double ns_persistent = run_persistent(BENCH_SIZES[s], &persistent_size, &peak_nodes);
+		printf("persistent,%zu,%.0lf,%zu,%zu\n", BENCH_SIZES[s], ns_persistent,
+			   persistent_size, peak_nodes);
+		fflush(stdout);
+
+		if (copied_size != persistent_size) {
+			fprintf(stderr, "strategies disagree: %zu vs %zu\n", copied_size, persistent_size);
+			return 1;
+		}
+	}
+
+	logger_dtor();
+	return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack.h"
+#include "soa_stack.h"
+#include "logger.h"
+
+const size_t BENCH_SIZES[] = { 1 << 10, 1 << 14, 1 << 20 };
+const size_t BENCH_MIN_ELEMS = 1 << 26;
+
+typedef double (*aggregate_func)(void *stk);
+
+struct Aggregate {
+	const char *name;
+	aggregate_func aos;
+	aggregate_func soa;
+};
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+double aos_cost_sum(void *stk);
+double aos_weighted_sum(void *stk);
+double aos_amount_sum(void *stk);
+double aos_cost_range(void *stk);
+double soa_cost_sum(void *stk);
+double soa_weighted_sum(void *stk);
+double soa_amount_sum(void *stk);
+double soa_cost_range(void *stk);
+double measure(aggregate_func aggregate, void *stk, size_t size, double *result);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------
+// the array-of-structs baselines are the loops reports used to run over stk->data
+
+double aos_cost_sum(void *stk)
+{
+	const struct Stack *aos = (const struct Stack*) stk;
+	double sum = 0;
+	for (size_t i = 0; i < aos->size; i++)
+		sum += aos->data[i].cost;
+
+	return sum;
+}
+
+double aos_weighted_sum(void *stk)
+{
+	const struct Stack *aos = (const struct Stack*) stk;
+	double sum = 0;
+	for (size_t i = 0; i < aos->size; i++)
+		sum += aos->data[i].cost * aos->data[i].amount;
+
+	return sum;
+}
+
+double aos_amount_sum(void *stk)
+{
+	const struct Stack *aos = (const struct Stack*) stk;
+	long long sum = 0;
+	for (size_t i = 0; i < aos->size; i++)
+		sum += aos->data[i].amount;
+
+	return (double) sum;
+}
+
+double aos_cost_range(void *stk)
+{
+	const struct Stack *aos = (const struct Stack*) stk;
+	double min = aos->data[0].cost;
+	double max = aos->data[0].cost;
+	for (size_t i = 1; i < aos->size; i++) {
+		if (aos->data[i].cost < min) min = aos->data[i].cost;
+		if (aos->data[i].cost > max) max = aos->data[i].cost;
+	}
+
+	return max - min;
+}
+
+double soa_cost_sum(void *stk)
+{
+	return stack_cost_sum((struct SoaStack*) stk);
+}
+
+double soa_weighted_sum(void *stk)
+{
+	return stack_weighted_sum((struct SoaStack*) stk);
+}
+
+double soa_amount_sum(void *stk)
+{
+	return (double) stack_amount_sum((struct SoaStack*) stk);
+}
+
+double soa_cost_range(void *stk)
+{
+	double min = 0;
+	double max = 0;
+	stack_cost_range((struct SoaStack*) stk, &min, &max);
+	return max - min;
+}
+
+const struct Aggregate AGGREGATES[] = {
+	{ "cost_sum",		aos_cost_sum,		soa_cost_sum		},
+	{ "weighted_sum",	aos_weighted_sum,	soa_weighted_sum	},
+	{ "amount_sum",		aos_amount_sum,		soa_amount_sum		},
+	{ "cost_range",		aos_cost_range,		soa_cost_range		},
+};
+
+double measure(aggregate_func aggregate, void *stk, size_t size, double *result)
+{
+	size_t reps = BENCH_MIN_ELEMS / size;
+
+	double start = now();
+	for (size_t rep = 0; rep < reps; rep++)
+		*result += aggregate(stk);
+
+	return (now() - start) * 1e9 / (double) (reps * size);
+}
+
+int main(int argc, const char *argv[])
+{
+	bool is_json = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			is_json = true;
+		else {
+			fprintf(stderr, "usage: %s [--json]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	logger_ctor();
+
+	if (!is_json)
+		printf("kernel,aggregate,size,aos_ns_per_elem,soa_ns_per_elem,speedup,"
+			   "aos_bytes,soa_bytes\n");
+
+	for (size_t s = 0; s < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); s++) {
+		size_t size = BENCH_SIZES[s];
+
+		struct Stack aos = {};
+		struct SoaStack soa = {};
+		STACK_CTOR(&aos, print_elem);
+		SOA_STACK_CTOR(&soa, print_elem);
+		stack_set_validation(&aos, VALIDATE_HEADER, DEFAULT_VALIDATION_PERIOD);
+
+		unsigned state = 12345;
+		for (size_t i = 0; i < size; i++) {
+			state = state * 1103515245 + 12345;
+			elem_t value = { (double) (state >> 16) / 100.0, (int) (state >> 24) };
+			stack_push(&aos, value);
+			stack_push(&soa, value);
+		}
+
+		size_t aos_bytes = aos.capacity * sizeof(elem_t);
+		size_t soa_bytes = soa.capacity * (sizeof(double) + sizeof(int));
+
+		for (size_t a = 0; a < sizeof(AGGREGATES) / sizeof(AGGREGATES[0]); a++) {
+			double aos_result = 0;
+			double soa_result = 0;
+			double aos_ns = measure(AGGREGATES[a].aos, &aos, size, &aos_result);
+			double soa_ns = measure(AGGREGATES[a].soa, &soa, size, &soa_result);
+
+			if (is_json)
+				printf("{\"kernel\": \"%s\", \"aggregate\": \"%s\", \"size\": %zu, "
+					   "\"aos_ns_per_elem\": %.3lf, \"soa_ns_per_elem\": %.3lf, "
+					   "\"aos_bytes\": %zu, \"soa_bytes\": %zu}\n", soa_kernel(),
+					   AGGREGATES[a].name, size, aos_ns, soa_ns, aos_bytes, soa_bytes);
+			else
+				printf("%s,%s,%zu,%.3lf,%.3lf,%.2lf,%zu,%zu\n", soa_kernel(), AGGREGATES[a].name,
+					   size, aos_ns, soa_ns, aos_ns / soa_ns, aos_bytes, soa_bytes);
+			fflush(stdout);
+
+			// keeps the loops from being optimized out
+			if (aos_result != aos_result || soa_result != soa_result)
+				fprintf(stderr, "NaN aggregate\n");
+		}
+
+		stack_dtor(&aos);
+		stack_dtor(&soa);
+	}
+
+	logger_dtor();
+	return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack.h"
+#include "allocators.h"
+#include "logger.h"
+
+const size_t BENCH_SIZES[] = { 1 << 6, 1 << 10, 1 << 14, 1 << 20 };
+const size_t BENCH_MIN_OPS = 1 << 20;
+const size_t BENCH_SCAN_MAX = 1 << 10;
+const size_t BENCH_BULK_CHUNK = 64;
+const size_t BENCH_SMALL_SIZE = 4;
+const size_t BENCH_PARSE_BATCH = 16;
+
+#if defined(STACK_INLINE_CAPACITY) && defined(CANARY_PROTECTION) && defined(HASH_PROTECTION)
+const char *BENCH_CONFIG = "canary+hash+inline";
+#elif defined(CANARY_PROTECTION) && defined(HASH_PROTECTION)
+const char *BENCH_CONFIG = "canary+hash";
+#elif defined(CANARY_PROTECTION)
+const char *BENCH_CONFIG = "canary";
+#elif defined(HASH_PROTECTION)
+const char *BENCH_CONFIG = "hash";
+#else
+const char *BENCH_CONFIG = "plain";
+#endif
+
+const char *VALIDATION_NAMES[] = { "header", "periodic", "full" };
+
+struct Counting_ctx {
+	size_t allocations;
+	size_t bytes_copied;
+};
+
+struct Bench_result {
+	double ns_per_op;
+	size_t allocations;
+	size_t bytes_copied;
+};
+
+typedef size_t (*workload_func)(struct Stack *stk, size_t size);
+
+struct Workload {
+	const char *name;
+	workload_func prepare;
+	workload_func run;
+	bool is_reserved;
+};
+
+int print_elem(char *buffer, elem_t x, size_t n);
+double now();
+void *counting_allocate(void *ctx, size_t size);
+void *counting_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void counting_deallocate(void *ctx, void *ptr, size_t size);
+size_t run_none(struct Stack *stk, size_t size);
+size_t run_push(struct Stack *stk, size_t size);
+size_t run_pop(struct Stack *stk, size_t size);
+size_t run_mixed(struct Stack *stk, size_t size);
+size_t run_bulk(struct Stack *stk, size_t size);
+size_t run_growth(struct Stack *stk, size_t size);
+size_t run_small(struct Stack *stk, size_t size);
+size_t run_parse(struct Stack *stk, size_t size);
+size_t run_parse_tx(struct Stack *stk, size_t size);
+struct Bench_result measure(const struct Workload *workload, size_t size,
+							enum ValidationLevel validation);
+
+int print_elem(char *buffer, elem_t x, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", x.cost, x.amount);
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// heap allocator that counts calls and the bytes realloc had to move
+void *counting_allocate(void *ctx, size_t size)
+{
+	((struct Counting_ctx*) ctx)->allocations++;
+	return malloc(size);
+}
+
+void *counting_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	struct Counting_ctx *counts = (struct Counting_ctx*) ctx;
+	counts->allocations++;
+
+	void *mem = realloc(ptr, new_size);
+	if (mem != NULL && mem != ptr)
+		counts->bytes_copied += old_size < new_size ? old_size : new_size;
+
+	return mem;
+}
+
+void counting_deallocate(void *ctx, void *ptr, size_t size)
+{
+	(void) ctx;
+	(void) size;
+	free(ptr);
+}
+
+//-----------------------------
+// every workload returns the number of operations it did; prepare steps aren't timed
+
+size_t run_none(struct Stack *stk, size_t size)
+{
+	(void) stk;
+	(void) size;
+	return 0;
+}
+
+size_t run_push(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < size; i++)
+		stack_push(stk, value);
+
+	return size;
+}
+
+size_t run_pop(struct Stack *stk, size_t size)
+{
+	elem_t value = {};
+	for (size_t i = 0; i < size; i++)
+		stack_pop(stk, &value);
+
+	return size;
+}
+
+size_t run_mixed(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	unsigned state = 12345;
+	for (size_t i = 0; i < 2 * size; i++) {
+		state = state * 1103515245 + 12345;
+		if ((state >> 16) & 1 || stk->size == 0)
+			stack_push(stk, value);
+		else
+			stack_pop(stk, &value);
+	}
+
+	return 2 * size;
+}
+
+size_t run_bulk(struct Stack *stk, size_t size)
+{
+	elem_t chunk[BENCH_BULK_CHUNK] = {};
+	size_t num_chunks = (size + BENCH_BULK_CHUNK - 1) / BENCH_BULK_CHUNK;
+
+	for (size_t i = 0; i < num_chunks; i++)
+		stack_push_n(stk, chunk, BENCH_BULK_CHUNK);
+	for (size_t i = 0; i < num_chunks; i++)
+		stack_pop_n(stk, chunk, BENCH_BULK_CHUNK);
+
+	return 2 * num_chunks * BENCH_BULK_CHUNK;
+}
+
+size_t run_growth(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < size; i++)
+		stack_push(stk, value);
+	for (size_t i = 0; i < size; i++)
+		stack_pop(stk, &value);
+
+	return 2 * size;
+}
+
+// short-lived stacks of a few elements, constructed and destroyed inside the timing
+size_t run_small(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	for (size_t i = 0; i < size; i++) {
+		struct Stack small = {};
+		STACK_CTOR_ALLOC(&small, print_elem, stk->allocator);
+		stack_set_validation(&small, stk->validation, stk->validation_period);
+
+		for (size_t j = 0; j < BENCH_SMALL_SIZE; j++)
+			stack_push(&small, value);
+		for (size_t j = 0; j < BENCH_SMALL_SIZE; j++)
+			stack_pop(&small, &value);
+
+		stack_dtor(&small);
+	}
+
+	return 2 * BENCH_SMALL_SIZE * size;
+}
+
+// batches of tokens pushed on top of the elements, every other batch thrown away
+size_t run_parse(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	size_t batches = (size + BENCH_PARSE_BATCH - 1) / BENCH_PARSE_BATCH;
+	for (size_t i = 0; i < batches; i++) {
+		for (size_t j = 0; j < BENCH_PARSE_BATCH; j++)
+			stack_push(stk, value);
+		if (i % 2 == 1)
+			stack_pop_n(stk, NULL, BENCH_PARSE_BATCH);
+	}
+
+	return batches * BENCH_PARSE_BATCH;
+}
+
+// the same with each batch in a transaction
+size_t run_parse_tx(struct Stack *stk, size_t size)
+{
+	elem_t value = {1.0, 1};
+	size_t batches = (size + BENCH_PARSE_BATCH - 1) / BENCH_PARSE_BATCH;
+	for (size_t i = 0; i < batches; i++) {
+		stack_begin(stk);
+		for (size_t j = 0; j < BENCH_PARSE_BATCH; j++)
+			stack_push(stk, value);
+		if (i % 2 == 1)
+			stack_rollback(stk);
+		else
+			stack_commit(stk);
+	}
+
+	return batches * BENCH_PARSE_BATCH;
+}
+
+const struct Workload WORKLOADS[] = {
+	{ "push",	run_none,	run_push,	true  },
+	{ "pop",	run_push,	run_pop,	true  },
+	{ "mixed",	run_push,	run_mixed,	true  },
+	{ "bulk",	run_none,	run_bulk,	true  },
+	{ "growth",	run_none,	run_growth,	false },
+	{ "small",	run_none,	run_small,	false },
+	{ "parse",	run_push,	run_parse,	true  },
+	{ "parse-tx", run_push,	run_parse_tx, true  },
+};
+
+struct Bench_result measure(const struct Workload *workload, size_t size,
+							enum ValidationLevel validation)
+{
+	struct Counting_ctx counts = {};
+	struct Stack_allocator allocator = {
+		counting_allocate, counting_reallocate, counting_deallocate, &counts
+	};
+
+	// periodic and full validation scan the whole buffer, so they get fewer reps
+	size_t reps = BENCH_MIN_OPS / size;
+	if (validation == VALIDATE_PERIODIC)
+		reps = reps * DEFAULT_VALIDATION_PERIOD / size;
+	else if (validation == VALIDATE_FULL)
+		reps = reps / size;
+	if (reps == 0)
+		reps = 1;
+
+	size_t ops = 0;
+	double elapsed = 0;
+
+	for (size_t rep = 0; rep < reps; rep++) {
+		struct Stack stk = {};
+		STACK_CTOR_ALLOC(&stk, print_elem, &allocator);
+		stack_set_validation(&stk, validation, DEFAULT_VALIDATION_PERIOD);
+		if (workload->is_reserved)
+			stack_reserve(&stk, 4 * size);
+		workload->prepare(&stk, size);
+
+		double start = now();
+		ops += workload->run(&stk, size);
+		elapsed += now() - start;
+
+		stack_dtor(&stk);
+	}
+
+	struct Bench_result result = {
+		elapsed * 1e9 / (double) ops,
+		counts.allocations / reps,
+		counts.bytes_copied / reps
+	};
+	return result;
+}
+
+int main(int argc, const char *argv[])
+{
+	bool is_json = false;
+	bool print_header = true;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0)
+			is_json = true;
+		else if (strcmp(argv[i], "--no-header") == 0)
+			print_header = false;
+		else {
+			fprintf(stderr, "usage: %s [--json] [--no-header]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	logger_ctor();
+
+	if (!is_json && print_header)
+		printf("config,validation,workload,size,ns_per_op,allocations,bytes_copied\n");
+
+	for (size_t v = 0; v < sizeof(VALIDATION_NAMES) / sizeof(VALIDATION_NAMES[0]); v++) {
+		for (size_t w = 0; w < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); w++) {
+			for (size_t s = 0; s < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); s++) {
+				enum ValidationLevel validation = (enum ValidationLevel) v;
+				if (validation != VALIDATE_HEADER && BENCH_SIZES[s] > BENCH_SCAN_MAX)
+					continue;
+
+				struct Bench_result result = measure(&WORKLOADS[w], BENCH_SIZES[s],
+													 validation);
+				if (is_json)
+					printf("{\"config\": \"%s\", \"validation\": \"%s\", "
+						   "\"workload\": \"%s\", \"size\": %zu, \"ns_per_op\": %.2lf, "
+						   "\"allocations\": %zu, \"bytes_copied\": %zu}\n",
+						   BENCH_CONFIG, VALIDATION_NAMES[v], WORKLOADS[w].name,
+						   BENCH_SIZES[s], result.ns_per_op, result.allocations,
+						   result.bytes_copied);
+				else
+					printf("%s,%s,%s,%zu,%.2lf,%zu,%zu\n", BENCH_CONFIG,
+						   VALIDATION_NAMES[v], WORKLOADS[w].name, BENCH_SIZES[s],
+						   result.ns_per_op, result.allocations, result.bytes_copied);
+				fflush(stdout);
+			}
+		}
+	}
+
+	logger_dtor();
+	return 0;
+}
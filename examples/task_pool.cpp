@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+
+#include "ws_deque.h"
+
+const long FIB_N = 32;
+const long FIB_CUTOFF = 16;
+
+struct Task_pool;
+
+typedef void (*task_func)(struct Task_pool *pool, void *arg);
+
+struct Task {
+	task_func func;
+	void *arg;
+	std::atomic<long> *pending;
+};
+
+struct Task_pool {
+	size_t num_workers;
+	struct WsDeque *deques;
+	std::thread *threads;
+	std::atomic<bool> is_stopped;
+};
+
+struct Fib_arg {
+	long n;
+	long result;
+};
+
+static thread_local size_t WORKER_ID = 0;
+
+enum StackError task_pool_ctor(struct Task_pool *pool, size_t num_workers);
+void task_pool_dtor(struct Task_pool *pool);
+enum StackError task_spawn(struct Task_pool *pool, task_func func, void *arg,
+						   std::atomic<long> *pending);
+void task_wait(struct Task_pool *pool, std::atomic<long> *pending);
+bool run_one_task(struct Task_pool *pool);
+void worker_loop(struct Task_pool *pool, size_t worker_id);
+long fib_seq(long n);
+void fib_task(struct Task_pool *pool, void *arg);
+double now();
+
+bool run_one_task(struct Task_pool *pool)
+{
+	void *value = NULL;
+	enum StackError error = ws_deque_pop(&pool->deques[WORKER_ID], &value);
+
+	for (size_t i = 1; error != STACK_NO_ERR && i < pool->num_workers; i++) {
+		size_t victim = (WORKER_ID + i) % pool->num_workers;
+		error = ws_deque_steal(&pool->deques[victim], &value);
+	}
+
+	if (error != STACK_NO_ERR)
+		return false;
+
+	struct Task *task = (struct Task*) value;
+	task->func(pool, task->arg);
+	task->pending->fetch_sub(1, std::memory_order_release);
+	free(task);
+
+	return true;
+}
+
+void worker_loop(struct Task_pool *pool, size_t worker_id)
+{
+	WORKER_ID = worker_id;
+
+	while (!pool->is_stopped.load(std::memory_order_acquire))
+		if (!run_one_task(pool))
+			std::this_thread::yield();
+}
+
+// the calling thread becomes worker 0 and must be the one that later calls dtor
+enum StackError task_pool_ctor(struct Task_pool *pool, size_t num_workers)
+{
+	pool->num_workers = num_workers;
+	pool->is_stopped.store(false);
+
+	pool->deques = new WsDeque[num_workers]();
+	for (size_t i = 0; i < num_workers; i++) {
+		enum StackError error = ws_deque_ctor(&pool->deques[i]);
+		if (error < 0) return error;
+	}
+
+	WORKER_ID = 0;
+	pool->threads = new std::thread[num_workers];
+	for (size_t i = 1; i < num_workers; i++)
+		pool->threads[i] = std::thread(worker_loop, pool, i);
+
+	return STACK_NO_ERR;
+}
+
+void task_pool_dtor(struct Task_pool *pool)
+{
+	pool->is_stopped.store(true, std::memory_order_release);
+	for (size_t i = 1; i < pool->num_workers; i++)
+		pool->threads[i].join();
+
+	for (size_t i = 0; i < pool->num_workers; i++)
+		ws_deque_dtor(&pool->deques[i]);
+
+	delete[] pool->threads;
+	delete[] pool->deques;
+}
+
+enum StackError task_spawn(struct Task_pool *pool, task_func func, void *arg,
+						   std::atomic<long> *pending)
+{
+	struct Task *task = (struct Task*) calloc(1, sizeof(Task));
+	if (task == NULL) return ERR_NO_MEM;
+
+	task->func = func;
+	task->arg = arg;
+	task->pending = pending;
+
+	pending->fetch_add(1, std::memory_order_relaxed);
+	enum StackError error = ws_deque_push(&pool->deques[WORKER_ID], task);
+	if (error < 0) {
+		pending->fetch_sub(1, std::memory_order_relaxed);
+		free(task);
+	}
+
+	return error;
+}
+
+// helps with other tasks instead of blocking, so nested waits cannot deadlock
+void task_wait(struct Task_pool *pool, std::atomic<long> *pending)
+{
+	while (pending->load(std::memory_order_acquire) > 0)
+		if (!run_one_task(pool))
+			std::this_thread::yield();
+}
+
+long fib_seq(long n)
+{
+	return n < 2 ? n : fib_seq(n - 1) + fib_seq(n - 2);
+}
+
+void fib_task(struct Task_pool *pool, void *arg)
+{
+	struct Fib_arg *fib = (struct Fib_arg*) arg;
+	if (fib->n < FIB_CUTOFF) {
+		fib->result = fib_seq(fib->n);
+		return;
+	}
+
+	struct Fib_arg left = { fib->n - 1, 0 };
+	struct Fib_arg right = { fib->n - 2, 0 };
+	std::atomic<long> pending(0);
+
+	if (task_spawn(pool, fib_task, &left, &pending) < 0)
+		fib_task(pool, &left);
+	fib_task(pool, &right);
+	task_wait(pool, &pending);
+
+	fib->result = left.result + right.result;
+}
+
+double now()
+{
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+int main()
+{
+	size_t max_workers = std::thread::hardware_concurrency();
+	if (max_workers == 0)
+		max_workers = 1;
+
+	for (size_t num_workers = 1; num_workers <= max_workers; num_workers *= 2) {
+		struct Task_pool pool = {};
+		if (task_pool_ctor(&pool, num_workers) < 0) {
+			fprintf(stderr, "Unable to start the task pool\n");
+			return 1;
+		}
+
+		struct Fib_arg fib = { FIB_N, 0 };
+		double start = now();
+		fib_task(&pool, &fib);
+		double elapsed = now() - start;
+
+		task_pool_dtor(&pool);
+
+		printf("workers = %lu: fib(%ld) = %ld in %.3lf s\n",
+			   num_workers, FIB_N, fib.result, elapsed);
+	}
+
+	return 0;
+}
@@ -0,0 +1,554 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "allocators.h"
+
+const size_t ALLOC_ALIGN = alignof(max_align_t);
+const size_t BLOCK_HEADER = (sizeof(Arena_block) + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+
+struct Pool_slab {
+	struct Pool_slab *next;
+};
+
+void *heap_allocate(void *ctx, size_t size);
+void *heap_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void heap_deallocate(void *ctx, void *ptr, size_t size);
+void *guard_allocate(void *ctx, size_t size);
+void *guard_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void guard_deallocate(void *ctx, void *ptr, size_t size);
+unsigned char *guard_mapping(const void *buffer, size_t size, size_t *length);
+void *arena_allocate(void *ctx, size_t size);
+void *arena_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void arena_deallocate(void *ctx, void *ptr, size_t size);
+struct Arena_block *arena_add_block(struct Arena *arena, size_t size);
+void *pool_allocate(void *ctx, size_t size);
+void *pool_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void pool_deallocate(void *ctx, void *ptr, size_t size);
+size_t pool_class(size_t size);
+void *vm_allocate(void *ctx, size_t size);
+void *vm_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void vm_deallocate(void *ctx, void *ptr, size_t size);
+bool vm_commit(struct Vm_region *region, size_t size);
+size_t round_to_page(size_t size);
+void *file_map_allocate(void *ctx, size_t size);
+void *file_map_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size);
+void file_map_deallocate(void *ctx, void *ptr, size_t size);
+bool is_mapped(const struct File_map *map, const void *ptr);
+
+const struct Stack_allocator HEAP_ALLOCATOR = {
+	heap_allocate, heap_reallocate, heap_deallocate, NULL
+};
+
+const struct Stack_allocator GUARD_ALLOCATOR = {
+	guard_allocate, guard_reallocate, guard_deallocate, NULL
+};
+
+#ifdef GUARD_PROTECTION
+const struct Stack_allocator *DEFAULT_ALLOCATOR = &GUARD_ALLOCATOR;
+#else
+const struct Stack_allocator *DEFAULT_ALLOCATOR = &HEAP_ALLOCATOR;
+#endif
+
+void *heap_allocate(void *ctx, size_t size)
+{
+	(void) ctx;
+	return malloc(size);
+}
+
+void *heap_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	(void) ctx;
+	(void) old_size;
+	return realloc(ptr, new_size);
+}
+
+void heap_deallocate(void *ctx, void *ptr, size_t size)
+{
+	(void) ctx;
+	(void) size;
+	free(ptr);
+}
+
+//-----------------------------
+
+/*
+* Every buffer gets its own mapping with a PROT_NONE page on each side. The
+* buffer is placed at the end of its pages, so the first byte past it is
+* already in the right guard page; underflows are caught once they cross the
+* page-rounding slack in front of the buffer.
+*/
+unsigned char *guard_mapping(const void *buffer, size_t size, size_t *length)
+{
+	size_t page_size = round_to_page(1);
+	*length = round_to_page(size) + 2 * page_size;
+
+	return (unsigned char*) ((uintptr_t) buffer / page_size * page_size - page_size);
+}
+
+bool is_guard_page(const void *buffer, size_t size, const void *addr)
+{
+	size_t page_size = round_to_page(1);
+	size_t length = 0;
+	const unsigned char *base = guard_mapping(buffer, size, &length);
+	const unsigned char *fault = (const unsigned char*) addr;
+
+	return (fault >= base && fault < base + page_size) ||
+		   (fault >= base + length - page_size && fault < base + length);
+}
+
+void *guard_allocate(void *ctx, size_t size)
+{
+	(void) ctx;
+	size_t page_size = round_to_page(1);
+	size_t body = round_to_page(size);
+
+	void *mem = mmap(NULL, body + 2 * page_size, PROT_NONE,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+
+	unsigned char *base = (unsigned char*) mem;
+	if (mprotect(base + page_size, body, PROT_READ | PROT_WRITE) != 0) {
+		munmap(mem, body + 2 * page_size);
+		return NULL;
+	}
+
+	return base + page_size + body - size;
+}
+
+/*
+* Shrinking stays in the same mapping. Growing moves the body pages into a
+* bigger reservation with mremap instead of copying them; the buffer still
+* shifts inside its pages to stay flush with the right guard page.
+*/
+void *guard_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	if (ptr == NULL) return guard_allocate(ctx, new_size);
+
+	size_t page_size = round_to_page(1);
+	size_t old_length = 0;
+	unsigned char *old_base = guard_mapping(ptr, old_size, &old_length);
+	size_t old_body = old_length - 2 * page_size;
+	size_t new_body = round_to_page(new_size);
+	size_t kept = old_size < new_size ? old_size : new_size;
+
+	if (new_body <= old_body) {
+		unsigned char *mem = old_base + page_size + new_body - new_size;
+		memmove(mem, ptr, kept);
+		if (new_body == old_body)
+			return mem;
+
+		if (mprotect(old_base + page_size + new_body, page_size, PROT_NONE) != 0) {
+			memmove(ptr, mem, kept);
+			return NULL;
+		}
+
+		munmap(old_base + 2 * page_size + new_body, old_body - new_body);
+		return mem;
+	}
+
+	size_t new_length = new_body + 2 * page_size;
+	void *reserved = mmap(NULL, new_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (reserved == MAP_FAILED) return NULL;
+
+	unsigned char *new_base = (unsigned char*) reserved;
+	if (mprotect(new_base + page_size, new_body, PROT_READ | PROT_WRITE) != 0 ||
+		mremap(old_base + page_size, old_body, old_body, MREMAP_MAYMOVE | MREMAP_FIXED,
+			   new_base + page_size) == MAP_FAILED) {
+		munmap(reserved, new_length);
+		return NULL;
+	}
+
+	// only the old guard pages are left of the old mapping
+	munmap(old_base, page_size);
+	munmap(old_base + page_size + old_body, page_size);
+
+	unsigned char *mem = new_base + page_size + new_body - new_size;
+	memmove(mem, new_base + ((unsigned char*) ptr - old_base), kept);
+
+	return mem;
+}
+
+void guard_deallocate(void *ctx, void *ptr, size_t size)
+{
+	(void) ctx;
+	if (ptr == NULL) return;
+
+	size_t length = 0;
+	munmap(guard_mapping(ptr, size, &length), length);
+}
+
+//-----------------------------
+
+enum StackError arena_ctor(struct Arena *arena, size_t block_size)
+{
+	arena->allocator = { arena_allocate, arena_reallocate, arena_deallocate, arena };
+	arena->blocks = NULL;
+	arena->block_size = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK;
+	arena->last = NULL;
+
+	if (arena_add_block(arena, arena->block_size) == NULL)
+		return ERR_NO_MEM;
+
+	return STACK_NO_ERR;
+}
+
+void arena_reset(struct Arena *arena)
+{
+	while (arena->blocks && arena->blocks->next) {
+		struct Arena_block *next = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+
+	if (arena->blocks)
+		arena->blocks->used = 0;
+	arena->last = NULL;
+}
+
+void arena_dtor(struct Arena *arena)
+{
+	arena_reset(arena);
+	free(arena->blocks);
+	arena->blocks = NULL;
+}
+
+struct Arena_block *arena_add_block(struct Arena *arena, size_t size)
+{
+	if (size < arena->block_size)
+		size = arena->block_size;
+
+	struct Arena_block *block = (struct Arena_block*) malloc(BLOCK_HEADER + size);
+	if (block == NULL) return NULL;
+
+	block->next = arena->blocks;
+	block->capacity = size;
+	block->used = 0;
+	arena->blocks = block;
+
+	return block;
+}
+
+void *arena_allocate(void *ctx, size_t size)
+{
+	struct Arena *arena = (struct Arena*) ctx;
+	size = (size + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+
+	struct Arena_block *block = arena->blocks;
+	if (block == NULL || block->capacity - block->used < size) {
+		block = arena_add_block(arena, size);
+		if (block == NULL) return NULL;
+	}
+
+	arena->last = (unsigned char*) block + BLOCK_HEADER + block->used;
+	block->used += size;
+
+	return arena->last;
+}
+
+void *arena_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	struct Arena *arena = (struct Arena*) ctx;
+	struct Arena_block *block = arena->blocks;
+
+	if (ptr != NULL && ptr == arena->last) {
+		size_t offset = (size_t) (arena->last - ((unsigned char*) block + BLOCK_HEADER));
+		size_t size = (new_size + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+		if (offset + size <= block->capacity) {
+			block->used = offset + size;
+			return ptr;
+		}
+	}
+
+	void *mem = arena_allocate(ctx, new_size);
+	if (mem == NULL) return NULL;
+
+	if (ptr != NULL)
+		memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+
+	return mem;
+}
+
+void arena_deallocate(void *ctx, void *ptr, size_t size)
+{
+	struct Arena *arena = (struct Arena*) ctx;
+	(void) size;
+
+	if (ptr != NULL && ptr == arena->last) {
+		arena->blocks->used = (size_t) (arena->last -
+										((unsigned char*) arena->blocks + BLOCK_HEADER));
+		arena->last = NULL;
+	}
+}
+
+//-----------------------------
+
+enum StackError pool_ctor(struct Pool *pool)
+{
+	pool->allocator = { pool_allocate, pool_reallocate, pool_deallocate, pool };
+	for (size_t i = 0; i < POOL_NUM_CLASSES; i++)
+		pool->free_lists[i] = NULL;
+	pool->slabs = NULL;
+
+	return STACK_NO_ERR;
+}
+
+void pool_dtor(struct Pool *pool)
+{
+	while (pool->slabs) {
+		struct Pool_slab *next = pool->slabs->next;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+
+	for (size_t i = 0; i < POOL_NUM_CLASSES; i++)
+		pool->free_lists[i] = NULL;
+}
+
+size_t pool_class(size_t size)
+{
+	size_t size_class = 0;
+	while (size_class < POOL_NUM_CLASSES && (POOL_MIN_CLASS << size_class) < size)
+		size_class++;
+
+	return size_class;
+}
+
+void *pool_allocate(void *ctx, size_t size)
+{
+	struct Pool *pool = (struct Pool*) ctx;
+	size_t size_class = pool_class(size);
+	if (size_class == POOL_NUM_CLASSES)
+		return malloc(size);
+
+	if (pool->free_lists[size_class] == NULL) {
+		size_t block_size = POOL_MIN_CLASS << size_class;
+		size_t slab_size = block_size > POOL_SLAB_SIZE ? block_size : POOL_SLAB_SIZE;
+
+		struct Pool_slab *slab = (struct Pool_slab*) malloc(ALLOC_ALIGN + slab_size);
+		if (slab == NULL) return NULL;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+
+		unsigned char *blocks = (unsigned char*) slab + ALLOC_ALIGN;
+		for (size_t offset = 0; offset + block_size <= slab_size; offset += block_size) {
+			*(void**) (blocks + offset) = pool->free_lists[size_class];
+			pool->free_lists[size_class] = blocks + offset;
+		}
+	}
+
+	void *block = pool->free_lists[size_class];
+	pool->free_lists[size_class] = *(void**) block;
+
+	return block;
+}
+
+void *pool_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	if (ptr != NULL && pool_class(old_size) == pool_class(new_size)) {
+		if (pool_class(new_size) < POOL_NUM_CLASSES)
+			return ptr;
+		return realloc(ptr, new_size);
+	}
+
+	void *mem = pool_allocate(ctx, new_size);
+	if (mem == NULL) return NULL;
+
+	if (ptr != NULL) {
+		memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+		pool_deallocate(ctx, ptr, old_size);
+	}
+
+	return mem;
+}
+
+void pool_deallocate(void *ctx, void *ptr, size_t size)
+{
+	struct Pool *pool = (struct Pool*) ctx;
+	if (ptr == NULL) return;
+
+	size_t size_class = pool_class(size);
+	if (size_class == POOL_NUM_CLASSES) {
+		free(ptr);
+		return;
+	}
+
+	*(void**) ptr = pool->free_lists[size_class];
+	pool->free_lists[size_class] = ptr;
+}
+
+//-----------------------------
+
+enum StackError vm_region_ctor(struct Vm_region *region, size_t reserve_size)
+{
+	region->allocator = { vm_allocate, vm_reallocate, vm_deallocate, region };
+	region->reserved = round_to_page(reserve_size > 0 ? reserve_size : VM_DEFAULT_RESERVE);
+	region->committed = 0;
+	region->is_used = false;
+
+	void *base = mmap(NULL, region->reserved, PROT_NONE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		region->base = NULL;
+		return ERR_NO_MEM;
+	}
+
+	region->base = (unsigned char*) base;
+#ifdef MADV_HUGEPAGE
+	madvise(base, region->reserved, MADV_HUGEPAGE);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+void vm_region_dtor(struct Vm_region *region)
+{
+	if (region->base != NULL)
+		munmap(region->base, region->reserved);
+
+	region->base = NULL;
+	region->reserved = 0;
+	region->committed = 0;
+	region->is_used = false;
+}
+
+size_t round_to_page(size_t size)
+{
+	static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	return (size + page_size - 1) / page_size * page_size;
+}
+
+// grows or shrinks the committed prefix of the region; fails only when growing
+bool vm_commit(struct Vm_region *region, size_t size)
+{
+	size = round_to_page(size);
+	if (size > region->reserved) return false;
+
+	if (size > region->committed) {
+		if (mprotect(region->base + region->committed, size - region->committed,
+					 PROT_READ | PROT_WRITE) != 0)
+			return false;
+	}
+	else if (size < region->committed) {
+		madvise(region->base + size, region->committed - size, MADV_DONTNEED);
+		mprotect(region->base + size, region->committed - size, PROT_NONE);
+	}
+
+	region->committed = size;
+	return true;
+}
+
+void *vm_allocate(void *ctx, size_t size)
+{
+	struct Vm_region *region = (struct Vm_region*) ctx;
+	if (region->base == NULL || region->is_used) return NULL;
+
+	if (!vm_commit(region, size)) return NULL;
+
+	region->is_used = true;
+	return region->base;
+}
+
+void *vm_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	struct Vm_region *region = (struct Vm_region*) ctx;
+	(void) old_size;
+
+	if (ptr == NULL) return vm_allocate(ctx, new_size);
+	if (ptr != region->base) return NULL;
+
+	return vm_commit(region, new_size) ? ptr : NULL;
+}
+
+void vm_deallocate(void *ctx, void *ptr, size_t size)
+{
+	struct Vm_region *region = (struct Vm_region*) ctx;
+	(void) size;
+
+	if (ptr == NULL || ptr != region->base) return;
+
+	vm_commit(region, 0);
+	region->is_used = false;
+}
+
+//-----------------------------
+
+enum StackError file_map_ctor(struct File_map *map, const char *path)
+{
+	map->allocator = { file_map_allocate, file_map_reallocate, file_map_deallocate, map };
+	map->base = NULL;
+	map->length = 0;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return STACK_FAILED;
+
+	struct stat info = {};
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		close(fd);
+		return STACK_FAILED;
+	}
+
+	void *base = mmap(NULL, (size_t) info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return ERR_NO_MEM;
+
+	map->base = (unsigned char*) base;
+	map->length = (size_t) info.st_size;
+
+	return STACK_NO_ERR;
+}
+
+void file_map_dtor(struct File_map *map)
+{
+	if (map->base != NULL)
+		munmap(map->base, map->length);
+
+	map->base = NULL;
+	map->length = 0;
+}
+
+bool is_mapped(const struct File_map *map, const void *ptr)
+{
+	const unsigned char *bytes = (const unsigned char*) ptr;
+	return map->base != NULL && bytes >= map->base && bytes < map->base + map->length;
+}
+
+void *file_map_allocate(void *ctx, size_t size)
+{
+	(void) ctx;
+	return malloc(size);
+}
+
+void *file_map_reallocate(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	struct File_map *map = (struct File_map*) ctx;
+
+	if (!is_mapped(map, ptr)) return realloc(ptr, new_size);
+
+	if ((unsigned char*) ptr + new_size <= map->base + map->length)
+		return ptr;
+
+	void *mem = malloc(new_size);
+	if (mem == NULL) return NULL;
+
+	memcpy(mem, ptr, old_size);
+	file_map_dtor(map);
+
+	return mem;
+}
+
+void file_map_deallocate(void *ctx, void *ptr, size_t size)
+{
+	struct File_map *map = (struct File_map*) ctx;
+	(void) size;
+
+	if (is_mapped(map, ptr))
+		file_map_dtor(map);
+	else
+		free(ptr);
+}
@@ -0,0 +1,86 @@
+#ifndef STACK_ALLOCATORS
+#define STACK_ALLOCATORS
+
+#include "stack.h"
+
+const size_t ARENA_DEFAULT_BLOCK	= 1 << 16;
+const size_t POOL_MIN_CLASS			= 32;
+const size_t POOL_NUM_CLASSES		= 16;
+const size_t POOL_SLAB_SIZE			= 1 << 16;
+const size_t VM_DEFAULT_RESERVE		= (size_t) 1 << 36;
+
+extern const struct Stack_allocator HEAP_ALLOCATOR;
+extern const struct Stack_allocator GUARD_ALLOCATOR;
+extern const struct Stack_allocator *DEFAULT_ALLOCATOR;
+
+struct Arena_block {
+	struct Arena_block *next;
+	size_t capacity;
+	size_t used;
+};
+
+/*
+* Bump allocator: frees are ignored (except for the latest allocation) and
+* all memory is released at once by arena_reset or arena_dtor. The latest
+* allocation can grow in place, so a single stack in an arena reallocates
+* without copying while the block has room.
+*/
+struct Arena {
+	struct Stack_allocator allocator;
+	struct Arena_block *blocks;
+	size_t block_size;
+	unsigned char *last;
+};
+
+/*
+* Power-of-two size classes from POOL_MIN_CLASS up, carved from slabs and
+* kept on per-class free lists; larger requests go straight to the heap.
+*/
+struct Pool {
+	struct Stack_allocator allocator;
+	void *free_lists[POOL_NUM_CLASSES];
+	struct Pool_slab *slabs;
+};
+
+/*
+* One stack per region: the whole range is reserved as PROT_NONE up front and
+* pages are committed with mprotect as the buffer grows, so reallocation never
+* moves or copies data. Pages past the new end are handed back with
+* MADV_DONTNEED on shrink, so resident memory follows the actual size.
+*/
+struct Vm_region {
+	struct Stack_allocator allocator;
+	unsigned char *base;
+	size_t reserved;
+	size_t committed;
+	bool is_used;
+};
+
+/*
+* Serves one stack whose buffer lives in a snapshot file: the file is mapped
+* private (copy-on-write), so pages are read in on first touch and writes
+* never reach the file. Growing the buffer past the end of the file moves it
+* to the heap.
+*/
+struct File_map {
+	struct Stack_allocator allocator;
+	unsigned char *base;
+	size_t length;
+};
+
+enum StackError arena_ctor(struct Arena *arena, size_t block_size);
+void arena_reset(struct Arena *arena);
+void arena_dtor(struct Arena *arena);
+
+enum StackError pool_ctor(struct Pool *pool);
+void pool_dtor(struct Pool *pool);
+
+bool is_guard_page(const void *buffer, size_t size, const void *addr);
+
+enum StackError vm_region_ctor(struct Vm_region *region, size_t reserve_size);
+void vm_region_dtor(struct Vm_region *region);
+
+enum StackError file_map_ctor(struct File_map *map, const char *path);
+void file_map_dtor(struct File_map *map);
+
+#endif
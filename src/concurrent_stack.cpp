@@ -0,0 +1,238 @@
+#include <stdlib.h>
+
+#include "concurrent_stack.h"
+
+const uint64_t ELIM_EMPTY = 0;
+const uint64_t ELIM_TAKEN = UINT64_MAX;
+const uint64_t CSTACK_MAX_NODES = CSTACK_FIRST_CHUNK * ((1ull << CSTACK_MAX_CHUNKS) - 1);
+
+enum Pop_result {
+	POP_OK			= 0,
+	POP_EMPTY		= 1,
+	POP_CONTENDED	= 2
+};
+
+struct Cstack_node *get_node(struct ConcurrentStack *stk, uint32_t ref);
+bool try_push_ref(struct ConcurrentStack *stk, std::atomic<uint64_t> *top, uint32_t ref);
+enum Pop_result try_pop_ref(struct ConcurrentStack *stk, std::atomic<uint64_t> *top,
+							uint32_t *ref);
+uint32_t alloc_node(struct ConcurrentStack *stk);
+void free_node(struct ConcurrentStack *stk, uint32_t ref);
+std::atomic<uint64_t> *random_elim_slot(struct ConcurrentStack *stk);
+bool eliminate_push(struct ConcurrentStack *stk, uint32_t ref);
+bool eliminate_pop(struct ConcurrentStack *stk, uint32_t *ref);
+
+// refs are node indices + 1, so 0 terminates lists
+struct Cstack_node *get_node(struct ConcurrentStack *stk, uint32_t ref)
+{
+	uint64_t index = ref - 1;
+	size_t chunk = (size_t) (63 - __builtin_clzll(index / CSTACK_FIRST_CHUNK + 1));
+	uint64_t offset = index - CSTACK_FIRST_CHUNK * ((1ull << chunk) - 1);
+
+	return stk->chunks[chunk].load(std::memory_order_acquire) + offset;
+}
+
+bool try_push_ref(struct ConcurrentStack *stk, std::atomic<uint64_t> *top, uint32_t ref)
+{
+	uint64_t old_top = top->load(std::memory_order_relaxed);
+	get_node(stk, ref)->next.store((uint32_t) old_top, std::memory_order_relaxed);
+
+	uint64_t new_top = (((old_top >> 32) + 1) << 32) | ref;
+	return top->compare_exchange_weak(old_top, new_top, std::memory_order_release,
+									  std::memory_order_relaxed);
+}
+
+enum Pop_result try_pop_ref(struct ConcurrentStack *stk, std::atomic<uint64_t> *top,
+							uint32_t *ref)
+{
+	uint64_t old_top = top->load(std::memory_order_acquire);
+	uint32_t top_ref = (uint32_t) old_top;
+	if (top_ref == 0)
+		return POP_EMPTY;
+
+	uint32_t next = get_node(stk, top_ref)->next.load(std::memory_order_relaxed);
+	uint64_t new_top = (((old_top >> 32) + 1) << 32) | next;
+	if (!top->compare_exchange_weak(old_top, new_top, std::memory_order_acquire,
+									std::memory_order_relaxed))
+		return POP_CONTENDED;
+
+	*ref = top_ref;
+	return POP_OK;
+}
+
+uint32_t alloc_node(struct ConcurrentStack *stk)
+{
+	uint32_t ref = 0;
+	enum Pop_result result = POP_CONTENDED;
+	while ((result = try_pop_ref(stk, &stk->free_head, &ref)) == POP_CONTENDED)
+		;
+	if (result == POP_OK)
+		return ref;
+
+	uint64_t index = stk->next_unused.fetch_add(1, std::memory_order_relaxed);
+	if (index >= CSTACK_MAX_NODES)
+		return 0;
+
+	size_t chunk = (size_t) (63 - __builtin_clzll(index / CSTACK_FIRST_CHUNK + 1));
+	if (stk->chunks[chunk].load(std::memory_order_acquire) == NULL) {
+		Cstack_node *mem = (Cstack_node*) calloc(CSTACK_FIRST_CHUNK << chunk,
+												 sizeof(Cstack_node));
+		if (mem == NULL)
+			return 0;
+
+		Cstack_node *expected = NULL;
+		if (!stk->chunks[chunk].compare_exchange_strong(expected, mem,
+														std::memory_order_acq_rel))
+			free(mem);
+	}
+
+	return (uint32_t) (index + 1);
+}
+
+void free_node(struct ConcurrentStack *stk, uint32_t ref)
+{
+	while (!try_push_ref(stk, &stk->free_head, ref))
+		;
+}
+
+std::atomic<uint64_t> *random_elim_slot(struct ConcurrentStack *stk)
+{
+	static thread_local uint32_t state = 0;
+	if (state == 0)
+		state = (uint32_t) (uintptr_t) &state | 1;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return stk->elimination + state % CSTACK_ELIM_SIZE;
+}
+
+bool eliminate_push(struct ConcurrentStack *stk, uint32_t ref)
+{
+	std::atomic<uint64_t> *slot = random_elim_slot(stk);
+
+	uint64_t expected = ELIM_EMPTY;
+	if (!slot->compare_exchange_strong(expected, ref, std::memory_order_release,
+									   std::memory_order_relaxed))
+		return false;
+
+	for (int i = 0; i < CSTACK_ELIM_SPINS; i++) {
+		if (slot->load(std::memory_order_acquire) == ELIM_TAKEN) {
+			slot->store(ELIM_EMPTY, std::memory_order_release);
+			return true;
+		}
+	}
+
+	expected = ref;
+	if (slot->compare_exchange_strong(expected, ELIM_EMPTY, std::memory_order_relaxed))
+		return false;
+
+	slot->store(ELIM_EMPTY, std::memory_order_release);
+	return true;
+}
+
+bool eliminate_pop(struct ConcurrentStack *stk, uint32_t *ref)
+{
+	std::atomic<uint64_t> *slot = random_elim_slot(stk);
+
+	uint64_t offer = slot->load(std::memory_order_acquire);
+	if (offer == ELIM_EMPTY || offer == ELIM_TAKEN)
+		return false;
+
+	if (!slot->compare_exchange_strong(offer, ELIM_TAKEN, std::memory_order_acq_rel,
+									   std::memory_order_relaxed))
+		return false;
+
+	*ref = (uint32_t) offer;
+	return true;
+}
+
+enum StackError stack_ctor(struct ConcurrentStack *stk)
+{
+	if (!stk) return STACK_FAILED;
+
+	if (stk->chunks[0].load() != NULL) return STACK_FAILED;
+
+	Cstack_node *mem = (Cstack_node*) calloc(CSTACK_FIRST_CHUNK, sizeof(Cstack_node));
+	if (mem == NULL) return ERR_NO_MEM;
+
+	stk->head.store(0);
+	stk->free_head.store(0);
+	stk->next_unused.store(0);
+	stk->size.store(0);
+	for (size_t i = 0; i < CSTACK_ELIM_SIZE; i++)
+		stk->elimination[i].store(ELIM_EMPTY);
+	stk->chunks[0].store(mem);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_dtor(struct ConcurrentStack *stk)
+{
+	if (!stk) return STACK_FAILED;
+
+	for (size_t i = 0; i < CSTACK_MAX_CHUNKS; i++) {
+		free(stk->chunks[i].load());
+		stk->chunks[i].store(NULL);
+	}
+
+	stk->head.store(0);
+	stk->free_head.store(0);
+	stk->next_unused.store(0);
+	stk->size.store(0);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_push(struct ConcurrentStack *stk, elem_t value)
+{
+	if (!stk) return STACK_FAILED;
+
+	uint32_t ref = alloc_node(stk);
+	if (ref == 0) return ERR_NO_MEM;
+
+	get_node(stk, ref)->value = value;
+
+	while (true) {
+		if (try_push_ref(stk, &stk->head, ref)) {
+			stk->size.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+
+		if (eliminate_push(stk, ref))
+			break;
+	}
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_pop(struct ConcurrentStack *stk, elem_t *value)
+{
+	if (!stk) return STACK_FAILED;
+
+	uint32_t ref = 0;
+	while (true) {
+		enum Pop_result result = try_pop_ref(stk, &stk->head, &ref);
+		if (result == POP_OK) {
+			stk->size.fetch_sub(1, std::memory_order_relaxed);
+			break;
+		}
+
+		if (result == POP_EMPTY)
+			return ERR_STACK_EMPTY;
+
+		if (eliminate_pop(stk, &ref))
+			break;
+	}
+
+	*value = get_node(stk, ref)->value;
+	free_node(stk, ref);
+
+	return STACK_NO_ERR;
+}
+
+size_t stack_size(struct ConcurrentStack *stk)
+{
+	return stk->size.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#ifndef CONCURRENT_STACK
+#define CONCURRENT_STACK
+
+#include <stdint.h>
+#include <atomic>
+
+#include "stack.h"
+
+const size_t CSTACK_FIRST_CHUNK	= 64;
+const size_t CSTACK_MAX_CHUNKS	= 26;
+const size_t CSTACK_ELIM_SIZE	= 16;
+const int CSTACK_ELIM_SPINS		= 64;
+
+struct Cstack_node {
+	elem_t value;
+	std::atomic<uint32_t> next;
+};
+
+/*
+* Treiber stack over a chunked node pool. Nodes are addressed by 32-bit
+* indices, so head and free list pack an index and an ABA tag into one
+* 64-bit word; node memory is only released in the destructor. Chunk k
+* holds CSTACK_FIRST_CHUNK << k nodes, so the pool grows by MULTIPLIER
+* without ever moving nodes. Contended operations try to meet a partner in
+* the elimination array before retrying.
+*/
+struct ConcurrentStack {
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> free_head;
+	std::atomic<uint64_t> next_unused;
+	std::atomic<size_t> size;
+	std::atomic<Cstack_node*> chunks[CSTACK_MAX_CHUNKS];
+	std::atomic<uint64_t> elimination[CSTACK_ELIM_SIZE];
+};
+
+enum StackError stack_ctor(struct ConcurrentStack *stk);
+enum StackError stack_dtor(struct ConcurrentStack *stk);
+enum StackError stack_push(struct ConcurrentStack *stk, elem_t value);
+enum StackError stack_pop(struct ConcurrentStack *stk, elem_t *value);
+size_t stack_size(struct ConcurrentStack *stk);
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+const uint64_t HASH_SEED		= 0xA0761D6478BD642FULL;
+const uint64_t HASH_PRIME_1		= 0xE7037ED1A0B428DBULL;
+const uint64_t HASH_PRIME_2		= 0x8EBC6AF09C88C6E3ULL;
+const uint64_t HASH_PRIME_3		= 0x589965CC75374CC3ULL;
+const size_t HASH_LANES			= 4;
+
+uint64_t mix(uint64_t a, uint64_t b);
+uint64_t read_word(const unsigned char *bytes);
+
+unsigned long gnu_hash(const void *data_ptr, size_t size)
+{
+	const unsigned char *data = (const unsigned char*) data_ptr;
+	unsigned long hash = 5381;
+
+	for (size_t i = 0; i < size; i++)
+		hash = ((hash << 5) + hash) + (long unsigned int) data[i];
+
+	return hash;
+}
+
+// folded 64x64->128 multiply, the core of wyhash
+uint64_t mix(uint64_t a, uint64_t b)
+{
+	unsigned __int128 product = (unsigned __int128) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+uint64_t read_word(const unsigned char *bytes)
+{
+	uint64_t word = 0;
+	memcpy(&word, bytes, sizeof(word));
+	return word;
+}
+
+/*
+* wyhash-style: 16 bytes per mix. Large inputs are split across four
+* independent lanes so the multiplies overlap instead of forming one chain.
+*/
+unsigned long word_hash(const void *data_ptr, size_t size)
+{
+	const unsigned char *data = (const unsigned char*) data_ptr;
+	uint64_t seed = HASH_SEED ^ mix(size ^ HASH_PRIME_1, HASH_PRIME_2);
+	size_t i = 0;
+
+	if (size >= 16 * HASH_LANES) {
+		uint64_t lanes[HASH_LANES] = { seed, seed ^ HASH_PRIME_1, seed ^ HASH_PRIME_2,
+									   seed ^ HASH_PRIME_3 };
+
+		for (; i + 16 * HASH_LANES <= size; i += 16 * HASH_LANES)
+			for (size_t lane = 0; lane < HASH_LANES; lane++)
+				lanes[lane] = mix(read_word(data + i + 16 * lane) ^ HASH_PRIME_1,
+								  read_word(data + i + 16 * lane + 8) ^ lanes[lane]);
+
+		seed = lanes[0] ^ mix(lanes[1] ^ HASH_PRIME_2, lanes[2] ^ lanes[3]);
+	}
+
+	for (; i + 16 <= size; i += 16)
+		seed = mix(read_word(data + i) ^ HASH_PRIME_1, read_word(data + i + 8) ^ seed);
+
+	unsigned char tail[16] = {};
+	memcpy(tail, data + i, size - i);
+	seed = mix(read_word(tail) ^ HASH_PRIME_1, read_word(tail + 8) ^ seed);
+
+	return mix(seed ^ HASH_PRIME_3, size ^ HASH_PRIME_1);
+}
+
+/*
+* The data hash is a sum of independent per-slot hashes (each one mixed with
+* the slot index), so changing one slot only needs its old and new hash
+*/
+unsigned long slot_hash(const void *slot, size_t elem_size, size_t index)
+{
+	unsigned long hash = hash_bytes(slot, elem_size) ^ (index * 0x9E3779B97F4A7C15UL);
+
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDUL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53UL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+unsigned long slots_hash(const void *slots, size_t elem_size, size_t from, size_t to)
+{
+	const unsigned char *bytes = (const unsigned char*) slots;
+	unsigned long hash = 0;
+	for (size_t i = from; i < to; i++)
+		hash += slot_hash(bytes + i * elem_size, elem_size, i);
+
+	return hash;
+}
@@ -0,0 +1,29 @@
+#ifndef STACK_HASH
+#define STACK_HASH
+
+#include <stddef.h>
+
+/*
+* hash_bytes is the hash used for stack headers and slots: word_hash unless
+* the build defines DJB2_HASH, which keeps the old byte-at-a-time gnu_hash.
+*/
+unsigned long gnu_hash(const void *data_ptr, size_t size);
+unsigned long word_hash(const void *data_ptr, size_t size);
+unsigned long slot_hash(const void *slot, size_t elem_size, size_t index);
+// sum of slot_hash over slots [from, to) of an array
+unsigned long slots_hash(const void *slots, size_t elem_size, size_t from, size_t to);
+
+enum Hash_kind {
+	HASH_WORD	= 0,
+	HASH_DJB2	= 1
+};
+
+#ifdef DJB2_HASH
+#define hash_bytes gnu_hash
+const enum Hash_kind HASH_KIND = HASH_DJB2;
+#else
+#define hash_bytes word_hash
+const enum Hash_kind HASH_KIND = HASH_WORD;
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "journal.h"
+#include "stack_debug.h"
+#include "hash.h"
+
+const size_t JOURNAL_POP_CHUNK = 64;
+
+char *make_path(const char *path, const char *suffix);
+size_t write_prefix(int fd, const void *data, size_t size);
+bool write_all(int fd, const void *data, size_t size);
+bool read_all(int fd, void *data, size_t size);
+bool sync_dir(const char *path);
+enum StackError journal_ctor(struct Journal *journal, const char *path, size_t sync_every);
+enum StackError start_journal(struct Journal *journal, uint64_t base_hash);
+enum StackError replay_journal(struct Stack *stk, struct Journal *journal, uint64_t base_hash);
+size_t replay_records(struct Stack *stk, const unsigned char *data, size_t size);
+enum StackError replay_pops(struct Stack *stk, size_t count);
+bool flush_buffer(struct Journal *journal);
+enum StackError append_record(struct Journal *journal, enum Journal_op op,
+							  const elem_t *values, uint32_t count);
+enum StackError append_records(struct Journal *journal, enum Journal_op op,
+							   const elem_t *values, size_t count);
+enum StackError end_operation(struct Stack *stk);
+
+char *make_path(const char *path, const char *suffix)
+{
+	size_t size = strlen(path) + strlen(suffix) + 1;
+	char *result = (char*) malloc(size);
+	if (result != NULL)
+		snprintf(result, size, "%s%s", path, suffix);
+
+	return result;
+}
+
+// bytes written before the first error
+size_t write_prefix(int fd, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*) data;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t written = write(fd, bytes + done, size - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written < 0)
+			break;
+
+		done += (size_t) written;
+	}
+
+	return done;
+}
+
+bool write_all(int fd, const void *data, size_t size)
+{
+	return write_prefix(fd, data, size) == size;
+}
+
+bool read_all(int fd, void *data, size_t size)
+{
+	unsigned char *bytes = (unsigned char*) data;
+	while (size > 0) {
+		ssize_t num_read = read(fd, bytes, size);
+		if (num_read < 0 && errno == EINTR)
+			continue;
+		if (num_read <= 0)
+			return false;
+
+		bytes += num_read;
+		size -= (size_t) num_read;
+	}
+
+	return true;
+}
+
+// makes a rename into the directory of path durable
+bool sync_dir(const char *path)
+{
+	char *copy = strdup(path);
+	if (copy == NULL) return false;
+
+	int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	free(copy);
+	if (fd < 0) return false;
+
+	bool is_synced = fsync(fd) == 0;
+	close(fd);
+
+	return is_synced;
+}
+
+enum StackError journal_ctor(struct Journal *journal, const char *path, size_t sync_every)
+{
+	*journal = {};
+	journal->fd = -1;
+	journal->sync_every = sync_every > 0 ? sync_every : 1;
+	journal->compact_bytes = JOURNAL_COMPACT_BYTES;
+	journal->buffer_capacity = JOURNAL_BUFFER_SIZE;
+
+	journal->buffer = (unsigned char*) malloc(JOURNAL_BUFFER_SIZE);
+	journal->snap_path = make_path(path, ".snap");
+	journal->wal_path = make_path(path, ".wal");
+	journal->tmp_path = make_path(path, ".tmp");
+
+	if (!journal->buffer || !journal->snap_path || !journal->wal_path || !journal->tmp_path) {
+		journal_dtor(journal);
+		return ERR_NO_MEM;
+	}
+
+	return STACK_NO_ERR;
+}
+
+void journal_dtor(struct Journal *journal)
+{
+	if (journal->fd >= 0) {
+		journal_commit(journal);
+		close(journal->fd);
+	}
+
+	free(journal->buffer);
+	free(journal->snap_path);
+	free(journal->wal_path);
+	free(journal->tmp_path);
+
+	*journal = {};
+	journal->fd = -1;
+}
+
+// an empty journal is written aside and renamed in, so the old one stays valid until then
+enum StackError start_journal(struct Journal *journal, uint64_t base_hash)
+{
+	int fd = open(journal->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0) return STACK_FAILED;
+
+	struct Journal_header header = {};
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.base_hash = base_hash;
+
+	if (!write_all(fd, &header, sizeof(header)) || fsync(fd) != 0 ||
+		rename(journal->tmp_path, journal->wal_path) != 0 || !sync_dir(journal->wal_path)) {
+		close(fd);
+		return STACK_FAILED;
+	}
+
+	if (journal->fd >= 0)
+		close(journal->fd);
+
+	journal->fd = fd;
+	journal->journal_bytes = 0;
+	journal->pending_ops = 0;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError replay_pops(struct Stack *stk, size_t count)
+{
+	elem_t values[JOURNAL_POP_CHUNK] = {};
+	while (count > 0) {
+		size_t n = count < JOURNAL_POP_CHUNK ? count : JOURNAL_POP_CHUNK;
+		enum StackError error = stack_pop_n(stk, values, n);
+		if (error != STACK_NO_ERR) return error;
+
+		count -= n;
+	}
+
+	return STACK_NO_ERR;
+}
+
+// returns the length of the prefix that was intact and replayed
+size_t replay_records(struct Stack *stk, const unsigned char *data, size_t size)
+{
+	size_t pos = 0;
+	while (size - pos >= sizeof(Journal_record) + sizeof(uint64_t)) {
+		struct Journal_record record = {};
+		memcpy(&record, data + pos, sizeof(record));
+		if (record.op != JOURNAL_PUSH && record.op != JOURNAL_POP)
+			break;
+
+		size_t payload = record.op == JOURNAL_PUSH ? record.count * sizeof(elem_t) : 0;
+		size_t record_size = sizeof(record) + payload + sizeof(uint64_t);
+		if (size - pos < record_size)
+			break;
+
+		uint64_t checksum = 0;
+		memcpy(&checksum, data + pos + sizeof(record) + payload, sizeof(checksum));
+		if (checksum != word_hash(data + pos, sizeof(record) + payload))
+			break;
+
+		// records are 8-byte multiples, so the payload is aligned for elem_t
+		enum StackError error = record.op == JOURNAL_PUSH ?
+			stack_push_n(stk, (const elem_t*) (data + pos + sizeof(record)), record.count) :
+			replay_pops(stk, record.count);
+		if (error != STACK_NO_ERR)
+			break;
+
+		pos += record_size;
+	}
+
+	return pos;
+}
+
+enum StackError replay_journal(struct Stack *stk, struct Journal *journal, uint64_t base_hash)
+{
+	int fd = open(journal->wal_path, O_RDWR | O_APPEND);
+	if (fd < 0)
+		return start_journal(journal, base_hash);
+
+	struct stat info = {};
+	struct Journal_header header = {};
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(header) ||
+		!read_all(fd, &header, sizeof(header)) ||
+		memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+		header.base_hash != base_hash) {
+		// a journal of an older snapshot: compaction stopped before replacing it
+		close(fd);
+		return start_journal(journal, base_hash);
+	}
+
+	size_t size = (size_t) info.st_size - sizeof(header);
+	unsigned char *data = (unsigned char*) malloc(size > 0 ? size : 1);
+	if (data == NULL) {
+		close(fd);
+		return ERR_NO_MEM;
+	}
+
+	size_t valid = read_all(fd, data, size) ? replay_records(stk, data, size) : 0;
+	free(data);
+
+	if (valid < size) {
+		log_message(WARN, "Journal %s: dropped %lu bytes of a torn or corrupted tail\n",
+					journal->wal_path, size - valid);
+		if (ftruncate(fd, (off_t) (sizeof(header) + valid)) != 0 || fsync(fd) != 0) {
+			close(fd);
+			return STACK_FAILED;
+		}
+	}
+
+	journal->fd = fd;
+	journal->journal_bytes = valid;
+	journal->pending_ops = 0;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_open(struct Stack *stk, print_func print_elem, struct Journal *journal,
+						   const char *path, size_t sync_every, const char *varname, int line,
+						   const char *filename, const char *funcname)
+{
+	enum StackError error = journal_ctor(journal, path, sync_every);
+	if (error != STACK_NO_ERR) return error;
+
+	struct Snapshot_header header = {};
+	if (access(journal->snap_path, F_OK) == 0) {
+		error = read_snapshot_header(journal->snap_path, &header);
+		if (error == STACK_NO_ERR)
+			error = stack_load(stk, print_elem, journal->snap_path, varname, line, filename,
+							   funcname);
+	}
+	else
+		error = stack_ctor(stk, print_elem, NULL, varname, line, filename, funcname);
+
+	if (error != STACK_NO_ERR) {
+		journal_dtor(journal);
+		return error;
+	}
+
+	// replay is trusted input; validating every record fully would make it quadratic
+	enum ValidationLevel level = stk->validation;
+	size_t period = stk->validation_period;
+	stack_set_validation(stk, VALIDATE_HEADER, period);
+	error = replay_journal(stk, journal, header.header_hash);
+	stack_set_validation(stk, level, period);
+
+	if (error != STACK_NO_ERR) {
+		stack_dtor(stk);
+		journal_dtor(journal);
+		return error;
+	}
+
+	stk->journal = journal;
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+// the new snapshot is durable before the journal is replaced; see replay_journal
+enum StackError stack_compact(struct Stack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	struct Journal *journal = stk->journal;
+	if (journal == NULL) return STACK_FAILED;
+
+	enum StackError error = journal_commit(journal);
+	if (error != STACK_NO_ERR) return error;
+
+	error = stack_save(stk, journal->tmp_path);
+	if (error != STACK_NO_ERR) return error;
+
+	if (rename(journal->tmp_path, journal->snap_path) != 0 || !sync_dir(journal->snap_path))
+		return STACK_FAILED;
+
+	struct Snapshot_header header = {};
+	error = read_snapshot_header(journal->snap_path, &header);
+	if (error != STACK_NO_ERR) return error;
+
+	return start_journal(journal, header.header_hash);
+}
+
+// whatever reached the file leaves the buffer, so a retry can't write a record twice
+bool flush_buffer(struct Journal *journal)
+{
+	size_t written = write_prefix(journal->fd, journal->buffer, journal->buffer_used);
+
+	journal->buffer_used -= written;
+	if (journal->buffer_used > 0)
+		memmove(journal->buffer, journal->buffer + written, journal->buffer_used);
+
+	return journal->buffer_used == 0;
+}
+
+enum StackError journal_commit(struct Journal *journal)
+{
+	if (journal->buffer_used == 0 && journal->pending_ops == 0)
+		return STACK_NO_ERR;
+
+	if (!flush_buffer(journal) || fdatasync(journal->fd) != 0) {
+		log_message(ERROR, "Journal %s: write failed\n", journal->wal_path);
+		return STACK_FAILED;
+	}
+
+	journal->pending_ops = 0;
+	return STACK_NO_ERR;
+}
+
+enum StackError append_record(struct Journal *journal, enum Journal_op op,
+							  const elem_t *values, uint32_t count)
+{
+	size_t payload = op == JOURNAL_PUSH ? count * sizeof(elem_t) : 0;
+	size_t record_size = sizeof(Journal_record) + payload + sizeof(uint64_t);
+
+	if (journal->buffer_used + record_size > journal->buffer_capacity && !flush_buffer(journal))
+		return STACK_FAILED;
+
+	if (record_size > journal->buffer_capacity) {
+		unsigned char *buffer = (unsigned char*) realloc(journal->buffer, record_size);
+		if (buffer == NULL) return ERR_NO_MEM;
+
+		journal->buffer = buffer;
+		journal->buffer_capacity = record_size;
+	}
+
+	unsigned char *dest = journal->buffer + journal->buffer_used;
+	struct Journal_record record = { (uint32_t) op, count };
+	memcpy(dest, &record, sizeof(record));
+	if (payload > 0)
+		memcpy(dest + sizeof(record), values, payload);
+
+	uint64_t checksum = word_hash(dest, sizeof(record) + payload);
+	memcpy(dest + sizeof(record) + payload, &checksum, sizeof(checksum));
+
+	journal->buffer_used += record_size;
+	journal->journal_bytes += record_size;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError append_records(struct Journal *journal, enum Journal_op op,
+							   const elem_t *values, size_t count)
+{
+	// counts are 32-bit on disk
+	while (count > 0) {
+		uint32_t n = count > UINT32_MAX ? UINT32_MAX : (uint32_t) count;
+		enum StackError error = append_record(journal, op, values, n);
+		if (error != STACK_NO_ERR) return error;
+
+		if (op == JOURNAL_PUSH)
+			values += n;
+		count -= n;
+	}
+
+	return STACK_NO_ERR;
+}
+
+// compaction saves the current stack, so it only runs once all records of an operation are in
+enum StackError end_operation(struct Stack *stk)
+{
+	struct Journal *journal = stk->journal;
+
+	if (++journal->pending_ops >= journal->sync_every) {
+		enum StackError error = journal_commit(journal);
+		if (error != STACK_NO_ERR) return error;
+	}
+
+	if (journal->journal_bytes >= journal->compact_bytes)
+		return stack_compact(stk);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError journal_record(struct Stack *stk, enum Journal_op op, const elem_t *values,
+							   size_t count)
+{
+	enum StackError error = append_records(stk->journal, op, values, count);
+	if (error != STACK_NO_ERR) return error;
+
+	return end_operation(stk);
+}
+
+enum StackError journal_record_change(struct Stack *stk, size_t popped, const elem_t *values,
+									  size_t pushed)
+{
+	enum StackError error = append_records(stk->journal, JOURNAL_POP, NULL, popped);
+	if (error != STACK_NO_ERR) return error;
+
+	error = append_records(stk->journal, JOURNAL_PUSH, values, pushed);
+	if (error != STACK_NO_ERR) return error;
+
+	return end_operation(stk);
+}
@@ -0,0 +1,72 @@
+#ifndef STACK_JOURNAL
+#define STACK_JOURNAL
+
+#include <stdint.h>
+
+#include "stack.h"
+
+#define STACK_OPEN(stk, print, journal, path, sync_every)									\
+		stack_open((stk), (print), (journal), (path), (sync_every), #stk, __LINE__, __FILE__,	\
+				   __func__)
+
+const char JOURNAL_MAGIC[8]				= "STKWAL1";
+const size_t JOURNAL_BUFFER_SIZE		= 1 << 16;
+const size_t JOURNAL_COMPACT_BYTES		= 1 << 24;
+
+enum Journal_op {
+	JOURNAL_PUSH	= 1,
+	JOURNAL_POP		= 2
+};
+
+/*
+* The journal file starts with a header naming the snapshot it applies to
+* (its header_hash, 0 for none), followed by records: a Journal_record, count
+* elements for pushes, and a word_hash checksum of both. Recovery replays
+* records up to the first torn or corrupted one and cuts the file there.
+*/
+struct Journal_header {
+	char magic[8];
+	uint64_t base_hash;
+};
+
+struct Journal_record {
+	uint32_t op;
+	uint32_t count;
+};
+
+/*
+* A persistent stack is <path>.snap (a stack_save snapshot) plus <path>.wal.
+* Records are buffered and fsync'ed once per sync_every operations (group
+* commit), so a crash loses at most the last unsynced batch. When the journal
+* grows past compact_bytes the stack is saved as the new snapshot and the
+* journal starts over.
+*/
+struct Journal {
+	int fd;
+	char *snap_path;
+	char *wal_path;
+	char *tmp_path;
+	unsigned char *buffer;
+	size_t buffer_capacity;
+	size_t buffer_used;
+	size_t sync_every;
+	size_t pending_ops;
+	size_t journal_bytes;
+	size_t compact_bytes;
+};
+
+// restores the stack from <path>.snap and <path>.wal and journals it from then on
+enum StackError stack_open(struct Stack *stk, print_func print_elem, struct Journal *journal,
+						   const char *path, size_t sync_every, const char *varname, int line,
+						   const char *filename, const char *funcname);
+enum StackError stack_compact(struct Stack *stk);
+enum StackError journal_record(struct Stack *stk, enum Journal_op op, const elem_t *values,
+							   size_t count);
+// pops popped elements and pushes values as one operation, for stack_commit
+enum StackError journal_record_change(struct Stack *stk, size_t popped, const elem_t *values,
+									  size_t pushed);
+// writes out buffered records and fsyncs them
+enum StackError journal_commit(struct Journal *journal);
+void journal_dtor(struct Journal *journal);
+
+#endif
@@ -1,19 +1,200 @@
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <assert.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 #include "colors.h"
 #include "logger.h"
 
+const size_t LOG_RECORD_SIZE = 1024;
+const size_t LOG_PREFIX_SIZE = 32;
+const auto LOG_WRITER_SLEEP = std::chrono::microseconds(200);
+const size_t LOG_EVENT_SIZE = 2048;
+
+/*
+* Records are formatted by the caller straight into a ring slot. The slot's
+* sequence number tells whose turn it is: pos when free for the producer that
+* claims position pos, pos + 1 once it is filled for the writer.
+*/
+struct Log_record {
+	std::atomic<size_t> sequence;
+	enum Log_level level;
+	const char *color;
+	char prefix[LOG_PREFIX_SIZE];
+	char text[LOG_RECORD_SIZE];
+};
+
+struct Log_ring {
+	struct Log_record *records = NULL;
+	size_t mask = 0;
+	enum Log_overflow overflow = LOG_DROP;
+	alignas(64) std::atomic<size_t> enqueue_pos {0};
+	alignas(64) std::atomic<size_t> written {0};
+	std::atomic<size_t> dropped {0};
+	std::atomic<bool> is_stopping {false};
+	std::thread writer {};
+};
+
 struct Logger LOGGER;
+struct Log_ring *LOG_RING = NULL;
+
+/*
+* Format strings are interned by address, id = slot + 1; id 0 means inline
+* text. Each slot also caches the argument kinds of its format, 4 bits per
+* argument ending with LOG_SIGNATURE_END, so encoding never parses it again.
+*/
+std::atomic<const char*> LOG_FORMATS[LOG_MAX_FORMATS];
+std::atomic<uint64_t> LOG_SIGNATURES[LOG_MAX_FORMATS];
+const uint64_t LOG_SIGNATURE_END = 0xF;
+const size_t LOG_SIGNATURE_ARGS = 15;
 
 enum Log_error do_log(enum Log_level level, const char *prefix, const char *color,
 					  const char *message, va_list args);
+enum Log_error write_record(enum Log_level level, const char *prefix, const char *color,
+							const char *text);
+struct Log_record *claim_record(struct Log_ring *ring, size_t *pos);
+size_t drain_records(struct Log_ring *ring, size_t pos);
+void log_writer(struct Log_ring *ring);
+bool has_handler(enum Log_level level, bool is_binary);
+uint64_t format_signature(const char *format);
+uint32_t intern_format(const char *format, uint64_t *signature);
+size_t encode_args(unsigned char *buff, size_t size, uint64_t signature, va_list args);
+enum Log_error write_binary(enum Log_level level, const char *prefix, const char *format,
+							va_list args);
 
 void logger_ctor()
 {
 	LOGGER.handlers = NULL;
 	LOGGER.num_handlers = 0;
+	LOGGER.min_level = LOG_LEVEL_OFF;
+}
+
+enum Log_error logger_start_async(size_t capacity, enum Log_overflow overflow)
+{
+	if (LOG_RING != NULL) return NO_LOG_ERR;
+
+	size_t ring_size = 2;
+	while (ring_size < capacity)
+		ring_size *= 2;
+
+	struct Log_ring *ring = new (std::nothrow) Log_ring;
+	if (ring == NULL) return ERR_MEM;
+
+	ring->records = new (std::nothrow) Log_record[ring_size];
+	if (ring->records == NULL) {
+		delete ring;
+		return ERR_MEM;
+	}
+
+	for (size_t i = 0; i < ring_size; i++)
+		ring->records[i].sequence.store(i, std::memory_order_relaxed);
+
+	ring->mask = ring_size - 1;
+	ring->overflow = overflow;
+
+	try {
+		ring->writer = std::thread(log_writer, ring);
+	} catch (...) {
+		delete[] ring->records;
+		delete ring;
+		return ERR_MEM;
+	}
+
+	LOG_RING = ring;
+	return NO_LOG_ERR;
+}
+
+void logger_flush()
+{
+	if (LOG_RING == NULL) return;
+
+	size_t target = LOG_RING->enqueue_pos.load(std::memory_order_acquire);
+	while (LOG_RING->written.load(std::memory_order_acquire) < target)
+		std::this_thread::yield();
+}
+
+// returns NULL if the ring is full and the overflow policy is LOG_DROP
+struct Log_record *claim_record(struct Log_ring *ring, size_t *pos)
+{
+	size_t claimed = ring->enqueue_pos.load(std::memory_order_relaxed);
+
+	while (true) {
+		struct Log_record *record = &ring->records[claimed & ring->mask];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t) sequence - (intptr_t) claimed;
+
+		if (diff == 0) {
+			if (ring->enqueue_pos.compare_exchange_weak(claimed, claimed + 1,
+														std::memory_order_relaxed)) {
+				*pos = claimed;
+				return record;
+			}
+		}
+		else if (diff < 0) {
+			if (ring->overflow == LOG_DROP) {
+				ring->dropped.fetch_add(1, std::memory_order_relaxed);
+				return NULL;
+			}
+
+			std::this_thread::yield();
+			claimed = ring->enqueue_pos.load(std::memory_order_relaxed);
+		}
+		else
+			claimed = ring->enqueue_pos.load(std::memory_order_relaxed);
+	}
+}
+
+// writes every filled record from pos on, returns the position after the last one
+size_t drain_records(struct Log_ring *ring, size_t pos)
+{
+	while (true) {
+		struct Log_record *record = &ring->records[pos & ring->mask];
+		if (record->sequence.load(std::memory_order_acquire) != pos + 1)
+			break;
+
+		write_record(record->level, record->prefix, record->color, record->text);
+		record->sequence.store(pos + ring->mask + 1, std::memory_order_release);
+		pos++;
+	}
+
+	return pos;
+}
+
+void log_writer(struct Log_ring *ring)
+{
+	size_t pos = 0;
+
+	while (true) {
+		bool is_stopping = ring->is_stopping.load(std::memory_order_acquire);
+		size_t new_pos = drain_records(ring, pos);
+
+		size_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+		if (dropped > 0) {
+			char text[LOG_PREFIX_SIZE + 32] = "";
+			snprintf(text, sizeof(text), "%zu log messages were dropped\n", dropped);
+			write_record(WARN, "[WARNING]", YELLOW, text);
+		}
+
+		if (new_pos != pos || dropped > 0) {
+			for (size_t i = 0; i < LOGGER.num_handlers; i++)
+				fflush(LOGGER.handlers[i].output);
+
+			pos = new_pos;
+			ring->written.store(pos, std::memory_order_release);
+			continue;
+		}
+
+		if (is_stopping)
+			break;
+
+		std::this_thread::sleep_for(LOG_WRITER_SLEEP);
+	}
 }
 
 enum Log_error add_log_handler(struct Log_handler handler)
@@ -33,9 +214,14 @@ enum Log_error add_log_handler(struct Log_handler handler)
 	}
 
 	LOGGER.handlers[LOGGER.num_handlers] = handler;
+	if (handler.level < LOGGER.min_level)
+		LOGGER.min_level = handler.level;
 
-	fprintf(LOGGER.handlers[LOGGER.num_handlers].output,
-			"\tSTART OF LOG\n-----------------------------\n\n");
+	if (handler.is_binary)
+		fwrite(LOG_BINARY_MAGIC, 1, sizeof(LOG_BINARY_MAGIC) - 1, handler.output);
+	else
+		fprintf(LOGGER.handlers[LOGGER.num_handlers].output,
+				"\tSTART OF LOG\n-----------------------------\n\n");
 	LOGGER.num_handlers++;
 
 	return NO_LOG_ERR;
@@ -43,49 +229,360 @@ enum Log_error add_log_handler(struct Log_handler handler)
 
 void logger_dtor()
 {
+	if (LOG_RING != NULL) {
+		LOG_RING->is_stopping.store(true, std::memory_order_release);
+		LOG_RING->writer.join();
+
+		delete[] LOG_RING->records;
+		delete LOG_RING;
+		LOG_RING = NULL;
+	}
+
 	for (size_t i = 0; i < LOGGER.num_handlers; i++)
-		fprintf(LOGGER.handlers[i].output,
-				"\n-----------------------------\n\tEND OF LOG\n");
+		if (!LOGGER.handlers[i].is_binary)
+			fprintf(LOGGER.handlers[i].output,
+					"\n-----------------------------\n\tEND OF LOG\n");
 	
 	free(LOGGER.handlers);
+	LOGGER.handlers = NULL;
+	LOGGER.num_handlers = 0;
+	LOGGER.min_level = LOG_LEVEL_OFF;
 }
 
-enum Log_error do_log(enum Log_level level, const char *prefix, const char *color,
-					  const char *message, va_list args)
+enum Log_error write_record(enum Log_level level, const char *prefix, const char *color,
+							const char *text)
 {
-	assert(message != NULL);
-	assert(prefix != NULL);
-	assert(color != NULL);
-
-	const size_t BUFF_SIZE = 1024;
-	char buff[BUFF_SIZE] = "";
-	
-	int written = vsnprintf(buff, BUFF_SIZE, message, args);
-	
 	bool error = 0;
 	for (size_t i = 0; i < LOGGER.num_handlers; i++) {
-		if (level < LOGGER.handlers[i].level)
+		if (level < LOGGER.handlers[i].level || LOGGER.handlers[i].is_binary)
 			continue;
 		
 		if (LOGGER.handlers[i].use_colors)
 			fprintf(LOGGER.handlers[i].output, "%s%s%s %s",
-					color, prefix, RESET_COLOR, buff);
+					color, prefix, RESET_COLOR, text);
 		else
-			fprintf(LOGGER.handlers[i].output, "%s %s", prefix, buff);
+			fprintf(LOGGER.handlers[i].output, "%s %s", prefix, text);
 
 		error = error || ferror(LOGGER.handlers[i].output);
 	}
 
-	if (written > (int) BUFF_SIZE - 1)
-		if (log_string(level, "...message was truncated\n") < 0)
-			return ERR_WRITE;
-	
 	if (error)
 		return ERR_WRITE;
 	return NO_LOG_ERR;
 }
 
-enum Log_error log_string(enum Log_level level, const char *message, ...)
+bool has_handler(enum Log_level level, bool is_binary)
+{
+	for (size_t i = 0; i < LOGGER.num_handlers; i++)
+		if (LOGGER.handlers[i].is_binary == is_binary && level >= LOGGER.handlers[i].level)
+			return true;
+
+	return false;
+}
+
+bool log_next_spec(const char *format, struct Log_spec *spec)
+{
+	const char *cur = strchr(format, '%');
+	if (cur == NULL) return false;
+
+	spec->begin = cur++;
+	spec->num_stars = 0;
+
+	while (*cur && strchr("-+ #0123456789.*'", *cur)) {
+		if (*cur == '*')
+			spec->num_stars++;
+		cur++;
+	}
+
+	int num_longs = 0;
+	bool is_long_double = false;
+	while (*cur && strchr("hlqLjzt", *cur)) {
+		if (*cur == 'L')
+			is_long_double = true;
+		else if (*cur != 'h')
+			num_longs++;
+		cur++;
+	}
+
+	switch (*cur) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			spec->kind = num_longs > 0 ? LOG_ARG_LONG : LOG_ARG_INT;
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			spec->kind = is_long_double ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+			break;
+		case 's':
+			spec->kind = LOG_ARG_STRING;
+			break;
+		case 'p':
+			spec->kind = LOG_ARG_POINTER;
+			break;
+		case 'n':
+			spec->kind = LOG_ARG_SKIP;
+			break;
+		default:
+			spec->kind = LOG_ARG_NONE;
+	}
+
+	spec->end = *cur ? cur + 1 : cur;
+	return true;
+}
+
+// returns 0 for formats with more arguments than a signature holds
+uint64_t format_signature(const char *format)
+{
+	uint64_t signature = 0;
+	size_t num_args = 0;
+	struct Log_spec spec = {};
+
+	for (; log_next_spec(format, &spec); format = spec.end) {
+		for (int i = 0; i <= spec.num_stars; i++) {
+			uint64_t kind = i < spec.num_stars ? LOG_ARG_INT : spec.kind;
+			if (kind == LOG_ARG_NONE)
+				continue;
+
+			if (num_args == LOG_SIGNATURE_ARGS)
+				return 0;
+
+			signature |= kind << (4 * num_args++);
+		}
+	}
+
+	return signature | LOG_SIGNATURE_END << (4 * num_args);
+}
+
+uint32_t intern_format(const char *format, uint64_t *signature)
+{
+	size_t start = ((uintptr_t) format >> 3) * 0x9E3779B97F4A7C15UL % LOG_MAX_FORMATS;
+
+	for (size_t probe = 0; probe < LOG_MAX_FORMATS; probe++) {
+		size_t slot = (start + probe) % LOG_MAX_FORMATS;
+		const char *expected = LOG_FORMATS[slot].load(std::memory_order_acquire);
+
+		if (expected == NULL &&
+			LOG_FORMATS[slot].compare_exchange_strong(expected, format,
+													  std::memory_order_acq_rel)) {
+			*signature = format_signature(format);
+			LOG_SIGNATURES[slot].store(*signature, std::memory_order_release);
+
+			uint32_t id = (uint32_t) (slot + 1);
+			uint32_t length = (uint32_t) strlen(format);
+			unsigned char type = LOG_REC_FORMAT;
+
+			for (size_t i = 0; i < LOGGER.num_handlers; i++) {
+				if (!LOGGER.handlers[i].is_binary)
+					continue;
+
+				FILE *output = LOGGER.handlers[i].output;
+				flockfile(output);
+				fwrite(&type, sizeof(type), 1, output);
+				fwrite(&id, sizeof(id), 1, output);
+				fwrite(&length, sizeof(length), 1, output);
+				fwrite(format, 1, length, output);
+				funlockfile(output);
+			}
+
+			return id;
+		}
+
+		if (expected == format) {
+			// the slot may be claimed by another thread that hasn't stored the signature yet
+			*signature = LOG_SIGNATURES[slot].load(std::memory_order_acquire);
+			if (*signature == 0)
+				*signature = format_signature(format);
+
+			return (uint32_t) (slot + 1);
+		}
+	}
+
+	return 0;
+}
+
+// returns the number of bytes used, or SIZE_MAX if the arguments don't fit
+size_t encode_args(unsigned char *buff, size_t size, uint64_t signature, va_list args)
+{
+	size_t used = 0;
+
+	for (; (signature & LOG_SIGNATURE_END) != LOG_SIGNATURE_END; signature >>= 4) {
+		int64_t integer = 0;
+		double real = 0;
+
+		switch ((enum Log_arg_kind) (signature & LOG_SIGNATURE_END)) {
+			case LOG_ARG_INT:
+				integer = va_arg(args, int);
+				break;
+			case LOG_ARG_LONG:
+				integer = va_arg(args, long long);
+				break;
+			case LOG_ARG_DOUBLE:
+				real = va_arg(args, double);
+				memcpy(&integer, &real, sizeof(real));
+				break;
+			case LOG_ARG_LONG_DOUBLE:
+				real = (double) va_arg(args, long double);
+				memcpy(&integer, &real, sizeof(real));
+				break;
+			case LOG_ARG_POINTER:
+				integer = (int64_t) (uintptr_t) va_arg(args, void*);
+				break;
+			case LOG_ARG_STRING: {
+				const char *string = va_arg(args, const char*);
+				if (string == NULL)
+					string = "(null)";
+
+				uint32_t length = (uint32_t) strnlen(string, LOG_RECORD_SIZE);
+				if (used + sizeof(length) + length > size) return SIZE_MAX;
+
+				memcpy(buff + used, &length, sizeof(length));
+				memcpy(buff + used + sizeof(length), string, length);
+				used += sizeof(length) + length;
+				continue;
+			}
+			case LOG_ARG_SKIP:
+				(void) va_arg(args, void*);
+				continue;
+			case LOG_ARG_NONE:
+			default:
+				continue;
+		}
+
+		if (used + sizeof(integer) > size) return SIZE_MAX;
+		memcpy(buff + used, &integer, sizeof(integer));
+		used += sizeof(integer);
+	}
+
+	return used;
+}
+
+/*
+* A binary event is the interned format id plus the raw arguments, so the
+* hot path does no formatting; log_decode renders it later. Formats that
+* don't fit in the intern table or its signatures and events with too long
+* arguments fall back to id 0 with the text formatted in place.
+*/
+enum Log_error write_binary(enum Log_level level, const char *prefix, const char *format,
+							va_list args)
+{
+	unsigned char event[LOG_EVENT_SIZE];
+	size_t header = 1 + sizeof(uint32_t) + 1 + 1 + LOG_PREFIX_SIZE +
+					sizeof(uint64_t) + sizeof(uint32_t);
+
+	uint64_t signature = 0;
+	uint32_t id = intern_format(format, &signature);
+	uint32_t args_size = 0;
+	unsigned char *args_buff = event + header;
+
+	if (id != 0 && signature != 0) {
+		va_list encode_list;
+		va_copy(encode_list, args);
+		size_t used = encode_args(args_buff, LOG_EVENT_SIZE - header, signature, encode_list);
+		va_end(encode_list);
+
+		if (used == SIZE_MAX)
+			id = 0;
+		else
+			args_size = (uint32_t) used;
+	}
+	else
+		id = 0;
+
+	if (id == 0) {
+		uint32_t length = 0;
+		int written = vsnprintf((char*) args_buff + sizeof(length),
+								LOG_EVENT_SIZE - header - sizeof(length), format, args);
+		length = (uint32_t) written;
+		if (written < 0)
+			length = 0;
+		else if (length > LOG_EVENT_SIZE - header - sizeof(length) - 1)
+			length = (uint32_t) (LOG_EVENT_SIZE - header - sizeof(length) - 1);
+		memcpy(args_buff, &length, sizeof(length));
+		args_size = (uint32_t) sizeof(length) + length;
+	}
+
+	struct timespec now = {};
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t timestamp = (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+
+	unsigned char prefix_size = (unsigned char) strnlen(prefix, LOG_PREFIX_SIZE);
+	unsigned char *cur = args_buff - sizeof(args_size) - sizeof(timestamp) - prefix_size -
+						 1 - 1 - sizeof(id) - 1;
+	unsigned char *start = cur;
+
+	*cur++ = LOG_REC_EVENT;
+	memcpy(cur, &id, sizeof(id));
+	cur += sizeof(id);
+	*cur++ = (unsigned char) level;
+	*cur++ = prefix_size;
+	memcpy(cur, prefix, prefix_size);
+	cur += prefix_size;
+	memcpy(cur, &timestamp, sizeof(timestamp));
+	cur += sizeof(timestamp);
+	memcpy(cur, &args_size, sizeof(args_size));
+
+	size_t event_size = (size_t) (args_buff - start) + args_size;
+
+	bool error = 0;
+	for (size_t i = 0; i < LOGGER.num_handlers; i++) {
+		if (!LOGGER.handlers[i].is_binary || level < LOGGER.handlers[i].level)
+			continue;
+
+		fwrite(start, 1, event_size, LOGGER.handlers[i].output);
+		error = error || ferror(LOGGER.handlers[i].output);
+	}
+
+	if (error)
+		return ERR_WRITE;
+	return NO_LOG_ERR;
+}
+
+enum Log_error do_log(enum Log_level level, const char *prefix, const char *color,
+					  const char *message, va_list args)
+{
+	assert(message != NULL);
+	assert(prefix != NULL);
+	assert(color != NULL);
+
+	int written = 0;
+	enum Log_error status = NO_LOG_ERR;
+
+	if (has_handler(level, true)) {
+		va_list binary_args;
+		va_copy(binary_args, args);
+		status = write_binary(level, prefix, message, binary_args);
+		va_end(binary_args);
+	}
+
+	if (!has_handler(level, false))
+		return status;
+
+	if (LOG_RING != NULL) {
+		size_t pos = 0;
+		struct Log_record *record = claim_record(LOG_RING, &pos);
+		if (record == NULL)
+			return ERR_WRITE;
+
+		record->level = level;
+		record->color = color;
+		snprintf(record->prefix, LOG_PREFIX_SIZE, "%s", prefix);
+		written = vsnprintf(record->text, LOG_RECORD_SIZE, message, args);
+
+		record->sequence.store(pos + 1, std::memory_order_release);
+	}
+	else {
+		char buff[LOG_RECORD_SIZE] = "";
+		written = vsnprintf(buff, LOG_RECORD_SIZE, message, args);
+		if (write_record(level, prefix, color, buff) != NO_LOG_ERR)
+			status = ERR_WRITE;
+	}
+
+	if (written > (int) LOG_RECORD_SIZE - 1)
+		if (log_string(level, "...message was truncated\n") < 0)
+			return ERR_WRITE;
+	
+	return status;
+}
+
+enum Log_error (log_string)(enum Log_level level, const char *message, ...)
 {
 	assert(message != NULL);
 
@@ -95,7 +592,7 @@ enum Log_error log_string(enum Log_level level, const char *message, ...)
 	return do_log(level, "", RESET_COLOR, message, args);
 }
 
-enum Log_error log_message(enum Log_level level, const char *message, ...)
+enum Log_error (log_message)(enum Log_level level, const char *message, ...)
 {
 	assert(message != NULL);
 
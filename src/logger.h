@@ -25,6 +25,28 @@ enum Log_error {
 	ERR_WRITE	=	-2
 };
 
+/** What a caller does when the async ring buffer is full */
+enum Log_overflow {
+	/** Discard the record; the writer reports how many were dropped */
+	LOG_DROP	=	0,
+	/** Wait until the writer thread frees a slot */
+	LOG_BLOCK	=	1
+};
+
+/** Default number of records in the async ring buffer */
+const size_t LOG_RING_CAPACITY	= 1024;
+
+/**
+* Messages below this level are removed at compile time. Set it with e.g.
+* -DLOG_MIN_LEVEL=INFO; by default everything is compiled in.
+*/
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL DEBUG
+#endif
+
+/** The logger's min_level when no handler accepts anything */
+const int LOG_LEVEL_OFF = ERROR + 1;
+
 /** A struct representing the logger */
 struct Logger {
 	/** A number of handlers (files with configuration) currently in the logger */
@@ -33,8 +55,12 @@ struct Logger {
 	size_t capacity;
 	/** A pointer to an arrat of handlers */
 	struct Log_handler *handlers;
+	/** The lowest level any handler accepts, checked before a message is formatted */
+	int min_level;
 };
 
+extern struct Logger LOGGER;
+
 /** A struct representing log handler - a file that will receive logs */
 struct Log_handler {
 	/** Pointer to a file that logs will be written to */
@@ -43,6 +69,54 @@ struct Log_handler {
 	enum Log_level level;
 	/** Whether to write escape codes with foreground colors to this handler */ 
 	bool use_colors;
+	/** Whether to write compact binary records (see log_decode) instead of text */
+	bool is_binary;
+};
+
+/** Maximum number of distinct format strings a binary log can intern */
+const size_t LOG_MAX_FORMATS	= 1024;
+
+/** The first bytes of every binary log file */
+const char LOG_BINARY_MAGIC[] = "STKBLOG1";
+
+/** Record types in a binary log file */
+enum Log_record_type {
+	/** u32 id, u32 length, format string bytes */
+	LOG_REC_FORMAT	=	1,
+	/** u32 format id, u8 level, u8 prefix length, prefix, u64 timestamp (ns), u32 args length, args */
+	LOG_REC_EVENT	=	2
+};
+
+/** Kind of argument a printf conversion consumes */
+enum Log_arg_kind {
+	/** No argument (%%) */
+	LOG_ARG_NONE		=	0,
+	/** int or a shorter integer, stored as 8 bytes */
+	LOG_ARG_INT			=	1,
+	/** long, long long, size_t and the like, stored as 8 bytes */
+	LOG_ARG_LONG		=	2,
+	/** double, stored as 8 bytes */
+	LOG_ARG_DOUBLE		=	3,
+	/** long double, stored as an 8-byte double */
+	LOG_ARG_LONG_DOUBLE	=	4,
+	/** C string, stored as u32 length and the bytes */
+	LOG_ARG_STRING		=	5,
+	/** pointer, stored as 8 bytes */
+	LOG_ARG_POINTER		=	6,
+	/** %n pointer, consumed and not stored */
+	LOG_ARG_SKIP		=	7
+};
+
+/** One printf conversion found by log_next_spec */
+struct Log_spec {
+	/** Points to the '%' */
+	const char *begin;
+	/** Points past the conversion character */
+	const char *end;
+	/** Number of '*' width/precision int arguments taken before the value */
+	int num_stars;
+	/** Kind of the value argument */
+	enum Log_arg_kind kind;
 };
 
 /** 
@@ -56,6 +130,25 @@ void logger_ctor();
 */
 void logger_dtor();
 
+/**
+* Switches the logger to async mode: log calls format their message into a
+* lock-free ring buffer and a background thread writes batches of records to
+* the handlers. All handlers must be added before this call. logger_dtor
+* drains the buffer and stops the thread.
+*
+* @param [in] capacity number of records in the ring buffer (rounded up to a power of two)
+* @param [in] overflow what a log call does when the buffer is full
+*
+* @return ERR_MEM if the buffer or the thread couldn't be created, NO_LOG_ERR otherwise
+*/
+enum Log_error logger_start_async(size_t capacity, enum Log_overflow overflow);
+
+/**
+* Waits until every record logged so far has been written by the async writer.
+* Does nothing in sync mode.
+*/
+void logger_flush();
+
 /**
 * Adds a handler to the logger. Can be called anytime after constructor was called
 * 
@@ -75,7 +168,7 @@ enum Log_error add_log_handler(struct Log_handler handler);
 *
 * @return error in case writing failed in one of the handlers, NO_LOG_ERROR otherwise
 */
-enum Log_error log_message(enum Log_level level, const char *message, ...);
+enum Log_error (log_message)(enum Log_level level, const char *message, ...);
 
 /**
 * Logs the result of a test with appropriate prefix and colors
@@ -87,6 +180,29 @@ enum Log_error log_message(enum Log_level level, const char *message, ...);
 */
 enum Log_error log_test(bool is_succesful, int num_test, const char *message, ...);
 
-enum Log_error log_string(enum Log_level level, const char *message, ...);
+enum Log_error (log_string)(enum Log_level level, const char *message, ...);
+
+/**
+* Whether a message of this level would be written anywhere. Folds to false at
+* compile time for levels below LOG_MIN_LEVEL, otherwise it is a single load.
+*/
+#define LOG_ENABLED(level) ((level) >= LOG_MIN_LEVEL && (level) >= LOGGER.min_level)
+
+// arguments of a suppressed message are not evaluated
+#define log_message(level, ...) (LOG_ENABLED(level) ? (log_message)((level), __VA_ARGS__) \
+													: NO_LOG_ERR)
+#define log_string(level, ...) (LOG_ENABLED(level) ? (log_string)((level), __VA_ARGS__)	\
+												   : NO_LOG_ERR)
+
+/**
+* Finds the next printf conversion in a format string. Used by binary handlers
+* to store raw arguments and by the decoder to render them back.
+*
+* @param [in] format a pointer into a printf format string
+* @param [out] spec the conversion found
+*
+* @return true if a conversion was found, false at the end of the string
+*/
+bool log_next_spec(const char *format, struct Log_spec *spec);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <limits.h>
+#include <vector>
 
 #include "stack.h"
+#include "typed_stack.h"
+#include "unique_stack.h"
+#include "persistent_stack.h"
 #include "stack_debug.h"
 #include "logger.h"
 
@@ -27,11 +31,24 @@ int main()
 	if (!log) {
 		log_message(WARN, "Unable to open log file\n");
 	} else {
-		setvbuf(log, NULL, _IONBF, 0);
 		add_log_handler({ log, DEBUG, false });
 	}
 
+	// make decode-check compares log_decode's rendering of this with log.txt
+	FILE *binary_log = fopen("log.bin", "wb");
+	if (!binary_log) {
+		log_message(WARN, "Unable to open binary log file\n");
+	} else {
+		add_log_handler({ binary_log, DEBUG, false, true });
+	}
+
+	logger_start_async(LOG_RING_CAPACITY, LOG_BLOCK);
+
 //-------------------------------
+	log_message(INFO, "int args: %u %x %X %o %hu %hhx %hd %hhd %c %d\n", 4000000000u,
+				4000000000u, UINT_MAX, 4000000000u, (unsigned short) 65535,
+				(unsigned char) 0xAB, (short) -12345, (signed char) -100, 'Z', INT_MIN);
+
 	struct Stack stk = {};
 	STACK_CTOR(&stk, print_struct);
 
@@ -41,10 +58,61 @@ int main()
 
 	stack_dump(&stk);
 	stack_dtor(&stk);
+
+	TypedStack<int> squares = {};
+	TYPED_STACK_CTOR(&squares);
+
+	for (int i = 0; i < 5; i++) {
+		stack_push(&squares, i * i);
+	}
+
+	stack_dump(&squares);
+	stack_dtor(&squares);
+
+	std::vector<UniqueStack> stacks;
+	for (int i = 0; i < 4; i++) {
+		stacks.push_back(UniqueStack());
+		for (int j = 0; j <= i; j++)
+			stacks.back().emplace(i + j * 0.25, j);
+	}
+
+	for (const UniqueStack &owned : stacks) {
+		double total = 0;
+		for (const struct Elem &elem : owned)
+			total += elem.cost * elem.amount;
+		log_message(INFO, "top amount %d, total %.2lf\n", owned.top().amount, total);
+	}
+
+	stacks.back().pop();
+	stack_dump(stacks.back().get());
+
+	struct Pstack_pool pool = {};
+	pstack_pool_ctor(&pool, NULL);
+
+	struct PersistentStack edits = {};
+	struct PersistentStack checkpoint = {};
+	PSTACK_CTOR(&edits, print_struct, &pool);
+	PSTACK_CTOR(&checkpoint, print_struct, &pool);
+
+	for (int i = 0; i < 3; i++)
+		stack_push(&edits, {i * 1.5, i});
+
+	stack_copy(&checkpoint, &edits);
+	stack_push(&edits, {99.0, 99});
+	stack_dump(&edits);
+
+	stack_copy(&edits, &checkpoint);
+	stack_dump(&edits);
+
+	stack_dtor(&checkpoint);
+	stack_dtor(&edits);
+	pstack_pool_dtor(&pool);
 //-----------------------------
 
 	logger_dtor();
 	fclose(log);
+	if (binary_log)
+		fclose(binary_log);
 	
 	return 0;
 }
@@ -0,0 +1,422 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "persistent_stack.h"
+#include "stack_debug.h"
+#include "allocators.h"
+#include "poison_scan.h"
+
+struct Pstack_node *alloc_node(struct Pstack_pool *pool);
+void free_node(struct Pstack_pool *pool, struct Pstack_node *node);
+void release_node(struct Pstack_pool *pool, struct Pstack_node *node);
+enum StackError check_node(struct Pstack_node *node, int *err);
+enum StackError validate_stack_header(struct PersistentStack *stk, int *err);
+
+#ifdef HASH_PROTECTION
+unsigned long node_hash(struct Pstack_node *node);
+void update_header_hash(struct PersistentStack *stk);
+#endif
+
+#ifdef HASH_PROTECTION
+unsigned long node_hash(struct Pstack_node *node)
+{
+	return hash_bytes(node, offsetof(Pstack_node, hash));
+}
+
+void update_header_hash(struct PersistentStack *stk)
+{
+	stk->hash = 0;
+	stk->hash = hash_bytes(stk, sizeof(PersistentStack));
+}
+#endif
+
+enum StackError pstack_pool_ctor(struct Pstack_pool *pool,
+								 const struct Stack_allocator *allocator)
+{
+	if (!pool) return STACK_FAILED;
+
+	pool->allocator = allocator ? allocator : DEFAULT_ALLOCATOR;
+	pool->chunks = NULL;
+	pool->free_list = NULL;
+	pool->num_chunks = 0;
+	pool->live_nodes = 0;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError pstack_pool_dtor(struct Pstack_pool *pool)
+{
+	if (!pool) return STACK_FAILED;
+
+	if (pool->live_nodes != 0) {
+		log_message(ERROR, "Node pool [%p] destroyed with %lu nodes in use\n",
+					pool, pool->live_nodes);
+		return STACK_FAILED;
+	}
+
+	while (pool->chunks) {
+		struct Pstack_chunk *next = pool->chunks->next;
+		pool->allocator->deallocate(pool->allocator->ctx, pool->chunks, sizeof(Pstack_chunk));
+		pool->chunks = next;
+	}
+
+	pool->free_list = NULL;
+	pool->num_chunks = 0;
+	pool->allocator = NULL;
+
+	return STACK_NO_ERR;
+}
+
+struct Pstack_node *alloc_node(struct Pstack_pool *pool)
+{
+	if (pool->free_list == NULL) {
+		struct Pstack_chunk *chunk = (struct Pstack_chunk*)
+			pool->allocator->allocate(pool->allocator->ctx, sizeof(Pstack_chunk));
+		if (chunk == NULL) return NULL;
+
+		chunk->next = pool->chunks;
+		pool->chunks = chunk;
+		pool->num_chunks++;
+
+		for (size_t i = PSTACK_CHUNK_NODES; i > 0; i--)
+			free_node(pool, chunk->nodes + i - 1);
+	}
+
+	struct Pstack_node *node = pool->free_list;
+	pool->free_list = node->next;
+	pool->live_nodes++;
+
+	return node;
+}
+
+void free_node(struct Pstack_pool *pool, struct Pstack_node *node)
+{
+	memset(node, POISON, sizeof(Pstack_node));
+	node->refs = 0;
+	node->next = pool->free_list;
+	pool->free_list = node;
+}
+
+// drops one reference, freeing the nodes that only this reference kept alive
+void release_node(struct Pstack_pool *pool, struct Pstack_node *node)
+{
+	while (node != NULL && --node->refs == 0) {
+		struct Pstack_node *next = node->next;
+		free_node(pool, node);
+		pool->live_nodes--;
+		node = next;
+	}
+}
+
+enum StackError stack_ctor(struct PersistentStack *stk, print_func print_elem,
+						   struct Pstack_pool *pool,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname)
+{
+	int err = {};
+	if (!stk) {
+		err |= 1 << NULL_STACK_POINTER;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	PRINT_ELEM = print_elem;
+
+	if (stk->top || stk->pool) {
+		err |= 1 << DOUBLE_CTOR;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	if (!pool) return STACK_FAILED;
+
+	stk->top = NULL;
+	stk->pool = pool;
+
+	stk->filename = filename;
+	stk->line = line;
+	stk->varname = varname;
+	stk->funcname = funcname;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = DEFAULT_CANARY;
+	stk->right_canary = DEFAULT_CANARY;
+#endif
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+// only the O(1) checks: a full walk would make dropping a snapshot cost its size
+enum StackError stack_dtor(struct PersistentStack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	release_node(stk->pool, stk->top);
+
+	stk->top = NULL;
+	stk->pool = NULL;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = 0;
+	stk->right_canary = 0;
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->hash = 0;
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_push(struct PersistentStack *stk, elem_t value)
+{
+	VALIDATE_STACK(stk);
+
+	struct Pstack_node *node = alloc_node(stk->pool);
+	if (node == NULL) return ERR_NO_MEM;
+
+	// the handle's reference to the old top becomes the new node's
+	memcpy(&node->value, &value, sizeof(elem_t));
+	node->next = stk->top;
+	node->size = stk->top ? stk->top->size + 1 : 1;
+	node->refs = 1;
+
+#ifdef HASH_PROTECTION
+	node->hash = node_hash(node);
+#endif
+
+	stk->top = node;
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_pop(struct PersistentStack *stk, elem_t *value)
+{
+	VALIDATE_STACK(stk);
+
+	struct Pstack_node *top = stk->top;
+	if (top == NULL) return ERR_STACK_EMPTY;
+
+	*value = top->value;
+
+	stk->top = top->next;
+	if (stk->top)
+		stk->top->refs++;
+	release_node(stk->pool, top);
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_top(struct PersistentStack *stk, elem_t *value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->top == NULL) return ERR_STACK_EMPTY;
+
+	*value = stk->top->value;
+
+	return STACK_NO_ERR;
+}
+
+size_t stack_size(struct PersistentStack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	return stk->top ? stk->top->size : 0;
+}
+
+enum StackError stack_copy(struct PersistentStack *dst, struct PersistentStack *src)
+{
+	int err = 0;
+	if (validate_stack_op(dst, &err) == STACK_FAILED) {
+		STACK_REPORT_FAIL(dst, err);
+		abort();
+	}
+
+	if (validate_stack_op(src, &err) == STACK_FAILED) {
+		STACK_REPORT_FAIL(src, err);
+		abort();
+	}
+
+	// taken before the release, so copying a handle to itself is safe
+	if (src->top)
+		src->top->refs++;
+	release_node(dst->pool, dst->top);
+
+	dst->top = src->top;
+	dst->pool = src->pool;
+
+#ifdef HASH_PROTECTION
+	update_header_hash(dst);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError check_node(struct Pstack_node *node, int *err)
+{
+	if (node->refs == 0 || is_poisoned(&node->value, sizeof(elem_t)))
+		*err |= 1 << POISONED_VALUE;
+
+#ifdef HASH_PROTECTION
+	if (node->hash != node_hash(node))
+		*err |= 1 << WRONG_DATA_HASH;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+enum StackError validate_stack_header(struct PersistentStack *stk, int *err)
+{
+	*err = 0;
+
+	if (!stk) {
+		*err |= 1 << NULL_STACK_POINTER;
+		return STACK_FAILED;
+	}
+
+	if (!stk->pool)
+		*err |= 1 << NULL_DATA_POINTER;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_hash = stk->hash;
+	stk->hash = 0;
+	if (old_hash != hash_bytes(stk, sizeof(PersistentStack)))
+		*err |= 1 << WRONG_HASH;
+	stk->hash = old_hash;
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY)
+		*err |= 1 << LEFT_CANARY_BAD;
+
+	if (stk->right_canary != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_CANARY_BAD;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+
+	if (stk->top)
+		return check_node(stk->top, err);
+	return STACK_NO_ERR;
+}
+
+enum StackError validate_stack(struct PersistentStack *stk, int *err)
+{
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+	if (stk->top == NULL)
+		return STACK_NO_ERR;
+
+	struct Pstack_node *node = stk->top;
+	for (size_t size = stk->top->size; size > 0; size--, node = node->next) {
+		if (node == NULL) {
+			*err |= 1 << NULL_DATA_POINTER;
+			return STACK_FAILED;
+		}
+
+		if (node->size != size)
+			*err |= 1 << SMALL_CAPACITY;
+
+		if (check_node(node, err) == STACK_FAILED)
+			return STACK_FAILED;
+	}
+
+	if (node != NULL)
+		*err |= 1 << CAPACITY_OVERFLOW;
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+// the top node is checked on every operation; the rest is shared and immutable
+enum StackError validate_stack_op(struct PersistentStack *stk, int *err)
+{
+	return validate_stack_header(stk, err);
+}
+
+void stack_dump(struct PersistentStack *stk)
+{
+	if (!LOG_ENABLED(DEBUG)) return;
+
+	const size_t SHOWN_MAX = 20;
+	log_message(DEBUG, "Stack [%p]\n", stk);
+
+	if (!stk) return;
+
+	log_string(DEBUG, "\t\"%s\" from %s (%d) %s()\n", stk->varname, stk->filename,
+			   stk->line, stk->funcname);
+
+	if (stk->pool) {
+		log_string(DEBUG, "\t{\n\t\tpool [%p]: %lu chunks, %lu nodes in use\n",
+				   stk->pool, stk->pool->num_chunks, stk->pool->live_nodes);
+	} else {
+		log_string(DEBUG, "\t{\n\t\tpool [NULL]\n");
+	}
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\tleft canary = 0x%llX\n", stk->left_canary);
+	log_string(DEBUG, "\t\tright canary = 0x%llX\n", stk->right_canary);
+#endif
+
+#ifdef HASH_PROTECTION
+	log_string(DEBUG, "\t\thash = 0x%lX\n", stk->hash);
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY || stk->right_canary != DEFAULT_CANARY) {
+		log_string(DEBUG, "\t}\n");
+		return;
+	}
+#endif
+
+	const size_t BUFF_SIZE = 1024;
+	char buffer[BUFF_SIZE] = {};
+
+	size_t shown = 0;
+	for (struct Pstack_node *node = stk->top; node && shown < SHOWN_MAX;
+		 node = node->next, shown++) {
+		PRINT_ELEM(buffer, node->value, BUFF_SIZE);
+		log_string(DEBUG, "\t\t*[%lu] = %s (node [%p], %lu refs)", node->size - 1, buffer,
+				   node, node->refs);
+		if (node->refs == 0 || is_poisoned(&node->value, sizeof(elem_t)))
+			log_string(DEBUG, " (poison)");
+		log_string(DEBUG, "\n");
+
+		// a freed node links into the free list, not into this version
+		if (node->refs == 0)
+			break;
+	}
+
+	if (stk->top && stk->top->size > shown)
+		log_string(DEBUG, "\t\t... %lu more\n", stk->top->size - shown);
+
+	log_string(DEBUG, "\t}\n");
+}
+
+void stack_report_fail(struct PersistentStack *stk, int err,
+					   const char *filename, int line, const char *func_name)
+{
+	log_stack_failures(err, filename, line, func_name);
+	stack_dump(stk);
+	logger_flush();
+}
@@ -0,0 +1,100 @@
+#ifndef PERSISTENT_STACK
+#define PERSISTENT_STACK
+
+#include "stack.h"
+
+#define PSTACK_CTOR(stk, print, pool) stack_ctor((stk), (print), (pool), #stk, __LINE__,		\
+												 __FILE__, __func__)
+
+const size_t PSTACK_CHUNK_NODES = 128;
+
+/*
+* Nodes are immutable once linked: a node holds one reference to next and a
+* version holds one reference to its top, so any number of versions share
+* their common tail. Free nodes are poisoned.
+*/
+struct Pstack_node {
+	elem_t value;
+	struct Pstack_node *next;
+	// elements in the version this node is the top of
+	size_t size;
+
+#ifdef HASH_PROTECTION
+	// covers value, next and size, the fields never written after linking
+	unsigned long hash;
+#endif
+
+	size_t refs;
+};
+
+struct Pstack_chunk {
+	struct Pstack_chunk *next;
+	struct Pstack_node nodes[PSTACK_CHUNK_NODES];
+};
+
+/*
+* Node pool shared by all versions of a stack. Released nodes go on the free
+* list; chunks are only given back to the allocator by pstack_pool_dtor.
+* Reference counts are plain integers, so a pool and its versions must be
+* used by one thread at a time.
+*/
+struct Pstack_pool {
+	const struct Stack_allocator *allocator;
+	struct Pstack_chunk *chunks;
+	struct Pstack_node *free_list;
+	size_t num_chunks;
+	size_t live_nodes;
+};
+
+/*
+* One version of a persistent stack. push and pop replace the version held by
+* this handle in O(1) without touching any other version, and stack_copy
+* makes a second handle to the same version in O(1), so a snapshot for undo
+* costs the same for any size. Destroying the last handle to a version frees
+* the nodes no other version uses.
+*/
+struct PersistentStack {
+#ifdef CANARY_PROTECTION
+	canary_t left_canary;
+#endif
+
+#ifdef HASH_PROTECTION
+	unsigned long hash;
+#endif
+
+	struct Pstack_node *top;
+	struct Pstack_pool *pool;
+	const char *varname;
+	const char *filename;
+	const char *funcname;
+	int line;
+
+#ifdef CANARY_PROTECTION
+	canary_t right_canary;
+#endif
+};
+
+enum StackError pstack_pool_ctor(struct Pstack_pool *pool,
+								 const struct Stack_allocator *allocator);
+// STACK_FAILED, leaving the pool as is, while any version still uses it
+enum StackError pstack_pool_dtor(struct Pstack_pool *pool);
+
+enum StackError stack_ctor(struct PersistentStack *stk, print_func print_elem,
+						   struct Pstack_pool *pool,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname);
+enum StackError stack_dtor(struct PersistentStack *stk);
+enum StackError stack_push(struct PersistentStack *stk, elem_t value);
+enum StackError stack_pop(struct PersistentStack *stk, elem_t *value);
+enum StackError stack_top(struct PersistentStack *stk, elem_t *value);
+size_t stack_size(struct PersistentStack *stk);
+// makes dst hold the version src holds; both stay usable independently
+enum StackError stack_copy(struct PersistentStack *dst, struct PersistentStack *src);
+
+enum StackError validate_stack(struct PersistentStack *stk, int *err);
+enum StackError validate_stack_op(struct PersistentStack *stk, int *err);
+void stack_dump(struct PersistentStack *stk);
+void stack_report_fail(struct PersistentStack *stk, int err,
+					   const char *filename, int line, const char *func_name);
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define POISON_SCAN_X86
+#endif
+
+#include "stack.h"
+#include "poison_scan.h"
+
+typedef size_t (*scan_func)(const unsigned char *bytes, size_t size);
+
+struct Scan_kernels {
+	const char *name;
+	scan_func find_poison_byte;
+	scan_func find_other_byte;
+};
+
+template <bool IS_POISON>
+size_t scan_scalar(const unsigned char *bytes, size_t size);
+bool has_zero_byte(uint64_t word);
+struct Scan_kernels select_kernels();
+const struct Scan_kernels *scan_kernels();
+
+#ifdef POISON_SCAN_X86
+template <bool IS_POISON>
+size_t scan_sse2(const unsigned char *bytes, size_t size);
+template <bool IS_POISON>
+__attribute__((target("avx2")))
+size_t scan_avx2(const unsigned char *bytes, size_t size);
+#endif
+
+bool has_zero_byte(uint64_t word)
+{
+	return ((word - 0x0101010101010101ull) & ~word & 0x8080808080808080ull) != 0;
+}
+
+// IS_POISON: find the first POISON byte; otherwise the first byte that isn't
+template <bool IS_POISON>
+size_t scan_scalar(const unsigned char *bytes, size_t size)
+{
+	const uint64_t pattern = 0x0101010101010101ull * (unsigned char) POISON;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word = 0;
+		memcpy(&word, bytes + i, sizeof(word));
+		if (IS_POISON ? has_zero_byte(word ^ pattern) : word != pattern)
+			break;
+	}
+
+	for (; i < size; i++)
+		if ((bytes[i] == (unsigned char) POISON) == IS_POISON)
+			return i;
+
+	return size;
+}
+
+#ifdef POISON_SCAN_X86
+template <bool IS_POISON>
+size_t scan_sse2(const unsigned char *bytes, size_t size)
+{
+	const __m128i poison = _mm_set1_epi8((char) POISON);
+	const unsigned full = IS_POISON ? 0 : 0xFFFF;
+
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		__m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (bytes + i)), poison);
+		__m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (bytes + i + 16)), poison);
+		__m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (bytes + i + 32)), poison);
+		__m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (bytes + i + 48)), poison);
+
+		__m128i all = IS_POISON ? _mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3))
+								: _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+		if ((unsigned) _mm_movemask_epi8(all) != full)
+			break;
+	}
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (bytes + i)), poison);
+		unsigned mask = (unsigned) _mm_movemask_epi8(eq) ^ full;
+		if (mask != 0)
+			return i + (size_t) __builtin_ctz(mask);
+	}
+
+	return i + scan_scalar<IS_POISON>(bytes + i, size - i);
+}
+
+template <bool IS_POISON>
+__attribute__((target("avx2")))
+size_t scan_avx2(const unsigned char *bytes, size_t size)
+{
+	const __m256i poison = _mm256_set1_epi8((char) POISON);
+	const unsigned full = IS_POISON ? 0 : 0xFFFFFFFF;
+
+	size_t i = 0;
+	for (; i + 128 <= size; i += 128) {
+		__m256i eq0 = _mm256_cmpeq_epi8(
+						_mm256_loadu_si256((const __m256i*) (bytes + i)), poison);
+		__m256i eq1 = _mm256_cmpeq_epi8(
+						_mm256_loadu_si256((const __m256i*) (bytes + i + 32)), poison);
+		__m256i eq2 = _mm256_cmpeq_epi8(
+						_mm256_loadu_si256((const __m256i*) (bytes + i + 64)), poison);
+		__m256i eq3 = _mm256_cmpeq_epi8(
+						_mm256_loadu_si256((const __m256i*) (bytes + i + 96)), poison);
+
+		__m256i all = IS_POISON ?
+					  _mm256_or_si256(_mm256_or_si256(eq0, eq1), _mm256_or_si256(eq2, eq3)) :
+					  _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+		if ((unsigned) _mm256_movemask_epi8(all) != full)
+			break;
+	}
+
+	for (; i + 32 <= size; i += 32) {
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (bytes + i)),
+									   poison);
+		unsigned mask = (unsigned) _mm256_movemask_epi8(eq) ^ full;
+		if (mask != 0)
+			return i + (size_t) __builtin_ctz(mask);
+	}
+
+	return i + scan_scalar<IS_POISON>(bytes + i, size - i);
+}
+#endif
+
+struct Scan_kernels select_kernels()
+{
+	const struct Scan_kernels scalar = {
+		"scalar", scan_scalar<true>, scan_scalar<false>
+	};
+
+#ifdef POISON_SCAN_X86
+	const struct Scan_kernels sse2 = {
+		"sse2", scan_sse2<true>, scan_sse2<false>
+	};
+	const struct Scan_kernels avx2 = {
+		"avx2", scan_avx2<true>, scan_avx2<false>
+	};
+
+	__builtin_cpu_init();
+	bool has_sse2 = __builtin_cpu_supports("sse2");
+	bool has_avx2 = __builtin_cpu_supports("avx2");
+
+	const char *forced = getenv("STACK_POISON_SCAN");
+	if (forced && strcmp(forced, "scalar") == 0)
+		return scalar;
+	if (forced && strcmp(forced, "sse2") == 0 && has_sse2)
+		return sse2;
+
+	if (has_avx2)
+		return avx2;
+	if (has_sse2)
+		return sse2;
+#endif
+
+	return scalar;
+}
+
+const struct Scan_kernels *scan_kernels()
+{
+	static const struct Scan_kernels kernels = select_kernels();
+	return &kernels;
+}
+
+/*
+* Vectors find the next POISON byte; only the element holding it is checked in
+* full. Data rarely contains POISON bytes, so this runs at the kernel's speed.
+*/
+size_t find_poisoned(const void *data, size_t count, size_t elem_size)
+{
+	const struct Scan_kernels *kernels = scan_kernels();
+	const unsigned char *bytes = (const unsigned char*) data;
+	size_t total = count * elem_size;
+
+	for (size_t pos = 0; pos < total;) {
+		pos += kernels->find_poison_byte(bytes + pos, total - pos);
+		if (pos == total)
+			break;
+
+		size_t index = pos / elem_size;
+		if (is_poisoned(bytes + index * elem_size, elem_size))
+			return index;
+
+		pos = (index + 1) * elem_size;
+	}
+
+	return count;
+}
+
+size_t find_unpoisoned(const void *data, size_t count, size_t elem_size)
+{
+	return scan_kernels()->find_other_byte((const unsigned char*) data,
+										   count * elem_size) / elem_size;
+}
+
+bool is_poisoned(const void *elem, size_t elem_size)
+{
+	return scan_scalar<false>((const unsigned char*) elem, elem_size) == elem_size;
+}
+
+const char *poison_scan_kernel()
+{
+	return scan_kernels()->name;
+}
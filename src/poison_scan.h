@@ -0,0 +1,21 @@
+#ifndef POISON_SCAN
+#define POISON_SCAN
+
+#include <stddef.h>
+
+/*
+* Poison scanning over raw element arrays. The byte kernels are picked once at
+* runtime: AVX2 or SSE2 where the CPU has them, 8-byte words otherwise.
+* STACK_POISON_SCAN=scalar|sse2|avx2 forces a kernel (for benchmarking).
+*/
+
+// index of the first element made entirely of POISON bytes, or count
+size_t find_poisoned(const void *data, size_t count, size_t elem_size);
+
+// index of the first element with a non-POISON byte, or count
+size_t find_unpoisoned(const void *data, size_t count, size_t elem_size);
+
+bool is_poisoned(const void *elem, size_t elem_size);
+const char *poison_scan_kernel();
+
+#endif
@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "seg_stack.h"
+#include "stack_debug.h"
+#include "allocators.h"
+#include "poison_scan.h"
+
+struct Seg_chunk *seg_chunk_ctor(struct SegStack *stk);
+void seg_chunk_dtor(struct SegStack *stk, struct Seg_chunk *chunk);
+bool is_poisoned_slot(const elem_t *slot);
+enum StackError validate_stack_header(struct SegStack *stk, int *err);
+
+#ifdef HASH_PROTECTION
+void update_header_hash(struct SegStack *stk);
+unsigned long chunk_hash(struct Seg_chunk *chunk, size_t first_index);
+#endif
+
+struct Seg_chunk *seg_chunk_ctor(struct SegStack *stk)
+{
+	struct Seg_chunk *chunk = (struct Seg_chunk*) stk->allocator->allocate(stk->allocator->ctx,
+																		   sizeof(Seg_chunk));
+	if (chunk == NULL) return NULL;
+
+	chunk->prev = NULL;
+	memset(chunk->data, POISON, sizeof(chunk->data));
+
+#ifdef CANARY_PROTECTION
+	chunk->left_canary = DEFAULT_CANARY;
+	chunk->right_canary = DEFAULT_CANARY;
+#endif
+
+	return chunk;
+}
+
+void seg_chunk_dtor(struct SegStack *stk, struct Seg_chunk *chunk)
+{
+	stk->allocator->deallocate(stk->allocator->ctx, chunk, sizeof(Seg_chunk));
+}
+
+bool is_poisoned_slot(const elem_t *slot)
+{
+	const unsigned char *bytes = (const unsigned char*) slot;
+	for (size_t i = 0; i < sizeof(elem_t); i++)
+		if (bytes[i] != (unsigned char) POISON)
+			return false;
+
+	return true;
+}
+
+#ifdef HASH_PROTECTION
+void update_header_hash(struct SegStack *stk)
+{
+	unsigned long data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	stk->hash = hash_bytes(stk, sizeof(SegStack));
+	stk->data_hash = data_hash;
+}
+
+unsigned long chunk_hash(struct Seg_chunk *chunk, size_t first_index)
+{
+	unsigned long hash = 0;
+	for (size_t i = 0; i < SEG_CHUNK_SIZE; i++)
+		hash += slot_hash(chunk->data + i, sizeof(elem_t), first_index + i);
+
+	return hash;
+}
+#endif
+
+enum StackError stack_ctor(struct SegStack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname)
+{
+	int err = {};
+	if (!stk) {
+		err |= 1 << NULL_STACK_POINTER;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	PRINT_ELEM = print_elem;
+
+	if (stk->top || stk->num_chunks != 0 || stk->size != 0) {
+		err |= 1 << DOUBLE_CTOR;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	stk->allocator = allocator ? allocator : DEFAULT_ALLOCATOR;
+	stk->top = seg_chunk_ctor(stk);
+	if (stk->top == NULL) return ERR_NO_MEM;
+
+	stk->size = 0;
+	stk->num_chunks = 1;
+	stk->spare = NULL;
+
+	stk->filename = filename;
+	stk->line = line;
+	stk->varname = varname;
+	stk->funcname = funcname;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = DEFAULT_CANARY;
+	stk->right_canary = DEFAULT_CANARY;
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->data_hash = chunk_hash(stk->top, 0);
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_dtor(struct SegStack *stk)
+{
+	VALIDATE_STACK_FULL(stk);
+
+	while (stk->top) {
+		struct Seg_chunk *prev = stk->top->prev;
+		seg_chunk_dtor(stk, stk->top);
+		stk->top = prev;
+	}
+
+	if (stk->spare)
+		seg_chunk_dtor(stk, stk->spare);
+
+	stk->spare = NULL;
+	stk->size = 0;
+	stk->num_chunks = 0;
+	stk->allocator = NULL;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = 0;
+	stk->right_canary = 0;
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->hash = 0;
+	stk->data_hash = 0;
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_push(struct SegStack *stk, elem_t value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == stk->num_chunks * SEG_CHUNK_SIZE) {
+		struct Seg_chunk *chunk = stk->spare;
+		if (chunk)
+			stk->spare = NULL;
+		else
+			chunk = seg_chunk_ctor(stk);
+
+		if (chunk == NULL) return ERR_NO_MEM;
+
+		chunk->prev = stk->top;
+		stk->top = chunk;
+		stk->num_chunks++;
+
+#ifdef HASH_PROTECTION
+		stk->data_hash += chunk_hash(chunk, stk->size);
+#endif
+	}
+
+	size_t index = stk->size++;
+	elem_t *slot = stk->top->data + (index - (stk->num_chunks - 1) * SEG_CHUNK_SIZE);
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = slot_hash(slot, sizeof(elem_t), index);
+#endif
+
+	*slot = value;
+
+#ifdef HASH_PROTECTION
+	stk->data_hash += slot_hash(slot, sizeof(elem_t), index) - old_slot_hash;
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_pop(struct SegStack *stk, elem_t *value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	size_t index = --stk->size;
+	elem_t *slot = stk->top->data + (index - (stk->num_chunks - 1) * SEG_CHUNK_SIZE);
+	*value = *slot;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = slot_hash(slot, sizeof(elem_t), index);
+#endif
+
+	memset(slot, POISON, sizeof(elem_t));
+
+#ifdef HASH_PROTECTION
+	stk->data_hash += slot_hash(slot, sizeof(elem_t), index) - old_slot_hash;
+#endif
+
+	if (stk->num_chunks > 1 && stk->size == (stk->num_chunks - 1) * SEG_CHUNK_SIZE) {
+		struct Seg_chunk *chunk = stk->top;
+		stk->top = chunk->prev;
+		stk->num_chunks--;
+
+#ifdef HASH_PROTECTION
+		stk->data_hash -= chunk_hash(chunk, stk->size);
+#endif
+
+		if (stk->spare)
+			seg_chunk_dtor(stk, stk->spare);
+		stk->spare = chunk;
+	}
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+elem_t *stack_elem(struct SegStack *stk, size_t index)
+{
+	VALIDATE_STACK(stk);
+
+	if (index >= stk->size) return NULL;
+
+	struct Seg_chunk *chunk = stk->top;
+	for (size_t i = index / SEG_CHUNK_SIZE + 1; i < stk->num_chunks; i++)
+		chunk = chunk->prev;
+
+	return chunk->data + index % SEG_CHUNK_SIZE;
+}
+
+enum StackError validate_stack_header(struct SegStack *stk, int *err)
+{
+	*err = 0;
+
+	if (!stk) {
+		*err |= 1 << NULL_STACK_POINTER;
+		return STACK_FAILED;
+	}
+
+	if (!stk->top)
+		*err |= 1 << NULL_DATA_POINTER;
+
+	if (stk->size > stk->num_chunks * SEG_CHUNK_SIZE)
+		*err |= 1 << CAPACITY_OVERFLOW;
+
+	if (stk->num_chunks == 0 ||
+		(stk->num_chunks > 1 && stk->size <= (stk->num_chunks - 1) * SEG_CHUNK_SIZE))
+		*err |= 1 << SMALL_CAPACITY;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_hash = stk->hash;
+	unsigned long old_data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	if (old_hash != hash_bytes(stk, sizeof(SegStack)))
+		*err |= 1 << WRONG_HASH;
+	stk->hash = old_hash;
+	stk->data_hash = old_data_hash;
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY)
+		*err |= 1 << LEFT_CANARY_BAD;
+
+	if (stk->right_canary != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_CANARY_BAD;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+
+#ifdef CANARY_PROTECTION
+	if (stk->top->left_canary != DEFAULT_CANARY)
+		*err |= 1 << LEFT_DATA_CANARY_BAD;
+
+	if (stk->top->right_canary != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_DATA_CANARY_BAD;
+#endif
+
+	size_t first_index = (stk->num_chunks - 1) * SEG_CHUNK_SIZE;
+	if (stk->size > 0 && is_poisoned_slot(stk->top->data + (stk->size - 1 - first_index)))
+		*err |= 1 << POISONED_VALUE;
+
+	if (stk->size < stk->num_chunks * SEG_CHUNK_SIZE &&
+		!is_poisoned_slot(stk->top->data + (stk->size - first_index)))
+		*err |= 1 << UNPOISONED_VALUE;
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+enum StackError validate_stack(struct SegStack *stk, int *err)
+{
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+#ifdef HASH_PROTECTION
+	unsigned long data_hash = 0;
+#endif
+
+	struct Seg_chunk *chunk = stk->top;
+	for (size_t i = stk->num_chunks; i > 0; i--, chunk = chunk->prev) {
+		if (chunk == NULL) {
+			*err |= 1 << NULL_DATA_POINTER;
+			return STACK_FAILED;
+		}
+
+#ifdef CANARY_PROTECTION
+		if (chunk->left_canary != DEFAULT_CANARY)
+			*err |= 1 << LEFT_DATA_CANARY_BAD;
+
+		if (chunk->right_canary != DEFAULT_CANARY)
+			*err |= 1 << RIGHT_DATA_CANARY_BAD;
+#endif
+
+		size_t first_index = (i - 1) * SEG_CHUNK_SIZE;
+		size_t used = stk->size > first_index ? stk->size - first_index : 0;
+		if (used > SEG_CHUNK_SIZE)
+			used = SEG_CHUNK_SIZE;
+
+		if (find_poisoned(chunk->data, used, sizeof(elem_t)) < used)
+			*err |= 1 << POISONED_VALUE;
+
+		if (find_unpoisoned(chunk->data + used, SEG_CHUNK_SIZE - used,
+							sizeof(elem_t)) < SEG_CHUNK_SIZE - used)
+			*err |= 1 << UNPOISONED_VALUE;
+
+#ifdef HASH_PROTECTION
+		data_hash += chunk_hash(chunk, first_index);
+#endif
+	}
+
+	if (chunk != NULL)
+		*err |= 1 << CAPACITY_OVERFLOW;
+
+#ifdef HASH_PROTECTION
+	if (data_hash != stk->data_hash)
+		*err |= 1 << WRONG_DATA_HASH;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+// chunks are bounded in size, so only the O(1) checks run on every operation
+enum StackError validate_stack_op(struct SegStack *stk, int *err)
+{
+	return validate_stack_header(stk, err);
+}
+
+void stack_dump(struct SegStack *stk)
+{
+	if (!LOG_ENABLED(DEBUG)) return;
+
+	const size_t POISONED_MAX = 20;
+	log_message(DEBUG, "Stack [%p]\n", stk);
+
+	if (!stk) return;
+
+	log_string(DEBUG, "\t\"%s\" from %s (%d) %s()\n", stk->varname, stk->filename,
+			   stk->line, stk->funcname);
+	log_string(DEBUG, "\t{\n\t\tsize = %lu\n"
+			   "\t\tchunks = %lu (%lu elements each)\n"
+			   "\t\tspare chunk [%p]\n",
+			   stk->size, stk->num_chunks, SEG_CHUNK_SIZE, stk->spare);
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\tleft canary = 0x%llX\n", stk->left_canary);
+	log_string(DEBUG, "\t\tright canary = 0x%llX\n", stk->right_canary);
+#endif
+
+#ifdef HASH_PROTECTION
+	log_string(DEBUG, "\t\thash = 0x%lX\n", stk->hash);
+	log_string(DEBUG, "\t\tdata hash = 0x%lX\n", stk->data_hash);
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY || stk->right_canary != DEFAULT_CANARY) {
+		log_string(DEBUG, "\t}\n");
+		return;
+	}
+#endif
+
+	const size_t BUFF_SIZE = 1024;
+	char buffer[BUFF_SIZE] = {};
+	size_t end = stk->size + POISONED_MAX;
+
+	struct Seg_chunk *chunk = stk->top;
+	for (size_t i = stk->num_chunks; i > 0 && chunk; i--, chunk = chunk->prev) {
+		size_t first_index = (i - 1) * SEG_CHUNK_SIZE;
+		log_string(DEBUG, "\t\tchunk %lu [%p]\n\t\t{\n", i - 1, chunk);
+
+#ifdef CANARY_PROTECTION
+		log_string(DEBUG, "\t\t\tleft canary = 0x%llX\n", chunk->left_canary);
+#endif
+
+		for (size_t j = 0; j < SEG_CHUNK_SIZE && first_index + j < end; j++) {
+			PRINT_ELEM(buffer, chunk->data[j], BUFF_SIZE);
+			log_string(DEBUG, first_index + j < stk->size ? "\t\t\t*[%lu] = " : "\t\t\t[%lu] = ",
+					   first_index + j);
+			log_string(DEBUG, "%s", buffer);
+			if (is_poisoned_slot(chunk->data + j))
+				log_string(DEBUG, " (poison)");
+			log_string(DEBUG, "\n");
+		}
+
+#ifdef CANARY_PROTECTION
+		log_string(DEBUG, "\t\t\tright canary = 0x%llX\n", chunk->right_canary);
+#endif
+
+		log_string(DEBUG, "\t\t}\n");
+	}
+
+	log_string(DEBUG, "\t}\n");
+}
+
+void stack_report_fail(struct SegStack *stk, int err,
+					   const char *filename, int line, const char *func_name)
+{
+	log_stack_failures(err, filename, line, func_name);
+	stack_dump(stk);
+	logger_flush();
+}
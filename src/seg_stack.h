@@ -0,0 +1,74 @@
+#ifndef SEG_STACK
+#define SEG_STACK
+
+#include "stack.h"
+
+#define SEG_STACK_CTOR(stk, print) stack_ctor((stk), (print), NULL, #stk, __LINE__, __FILE__,	\
+												  __func__)
+#define SEG_STACK_CTOR_ALLOC(stk, print, allocator) stack_ctor((stk), (print), (allocator),		\
+															   #stk, __LINE__, __FILE__,		\
+															   __func__)
+
+const size_t SEG_CHUNK_SIZE = 256;
+
+struct Seg_chunk {
+#ifdef CANARY_PROTECTION
+	canary_t left_canary;
+#endif
+
+	struct Seg_chunk *prev;
+	elem_t data[SEG_CHUNK_SIZE];
+
+#ifdef CANARY_PROTECTION
+	canary_t right_canary;
+#endif
+};
+
+/*
+* Stack stored as a list of fixed-size chunks: growing links a new chunk and
+* shrinking unlinks the top one, so no element is ever moved and pointers
+* returned by stack_elem stay valid until the element is popped. One empty
+* chunk is kept as a spare so that push/pop around a chunk boundary doesn't
+* allocate and free on every call.
+*/
+struct SegStack {
+#ifdef CANARY_PROTECTION
+	canary_t left_canary;
+#endif
+
+#ifdef HASH_PROTECTION
+	unsigned long hash;
+	unsigned long data_hash;
+#endif
+
+	size_t size;
+	size_t num_chunks;
+	struct Seg_chunk *top;
+	struct Seg_chunk *spare;
+	const struct Stack_allocator *allocator;
+	const char *varname;
+	const char *filename;
+	const char *funcname;
+	int line;
+
+#ifdef CANARY_PROTECTION
+	canary_t right_canary;
+#endif
+};
+
+enum StackError stack_ctor(struct SegStack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname);
+enum StackError stack_dtor(struct SegStack *stk);
+enum StackError stack_push(struct SegStack *stk, elem_t value);
+enum StackError stack_pop(struct SegStack *stk, elem_t *value);
+elem_t *stack_elem(struct SegStack *stk, size_t index);
+
+enum StackError validate_stack(struct SegStack *stk, int *err);
+enum StackError validate_stack_op(struct SegStack *stk, int *err);
+void stack_dump(struct SegStack *stk);
+void stack_report_fail(struct SegStack *stk, int err,
+					   const char *filename, int line, const char *func_name);
+
+#endif
@@ -0,0 +1,764 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SOA_X86
+#endif
+
+#include "logger.h"
+#include "soa_stack.h"
+#include "stack_debug.h"
+#include "allocators.h"
+#include "poison_scan.h"
+
+#ifdef CANARY_PROTECTION
+const size_t SOA_DATA_OFFSET = sizeof(canary_t);
+#else
+const size_t SOA_DATA_OFFSET = 0;
+#endif
+
+const size_t SOA_ELEM_SIZE = sizeof(double) + sizeof(int);
+
+struct Soa_kernels {
+	const char *name;
+	double (*sum_double)(const double *values, size_t n);
+	long long (*sum_int)(const int *values, size_t n);
+	double (*dot)(const double *costs, const int *amounts, size_t n);
+	void (*range_double)(const double *values, size_t n, double *min, double *max);
+	void (*range_int)(const int *values, size_t n, int *min, int *max);
+};
+
+size_t soa_capacity(size_t capacity);
+size_t soa_buffer_size(size_t capacity);
+size_t amount_offset(size_t capacity);
+unsigned char *soa_buffer(struct SoaStack *stk);
+void set_arrays(struct SoaStack *stk, unsigned char *mem, size_t capacity);
+void poison_slots(struct SoaStack *stk, size_t from, size_t to);
+enum StackError resize_soa(struct SoaStack *stk, size_t capacity);
+bool is_poisoned_elem(struct SoaStack *stk, size_t index);
+bool is_unpoisoned_elem(struct SoaStack *stk, size_t index);
+enum StackError validate_stack_header(struct SoaStack *stk, int *err);
+
+#ifdef CANARY_PROTECTION
+void set_data_canaries(struct SoaStack *stk);
+#endif
+
+#ifdef HASH_PROTECTION
+unsigned long soa_slot_hash(struct SoaStack *stk, size_t index);
+unsigned long soa_data_hash(struct SoaStack *stk);
+void update_header_hash(struct SoaStack *stk);
+#endif
+
+double sum_double_scalar(const double *values, size_t n);
+long long sum_int_scalar(const int *values, size_t n);
+double dot_scalar(const double *costs, const int *amounts, size_t n);
+void range_double_scalar(const double *values, size_t n, double *min, double *max);
+void range_int_scalar(const int *values, size_t n, int *min, int *max);
+struct Soa_kernels select_soa_kernels();
+const struct Soa_kernels *soa_kernels();
+
+#ifdef SOA_X86
+__attribute__((target("avx2")))
+double sum_double_avx2(const double *values, size_t n);
+__attribute__((target("avx2")))
+long long sum_int_avx2(const int *values, size_t n);
+__attribute__((target("avx2")))
+double dot_avx2(const double *costs, const int *amounts, size_t n);
+__attribute__((target("avx2")))
+void range_double_avx2(const double *values, size_t n, double *min, double *max);
+__attribute__((target("avx2")))
+void range_int_avx2(const int *values, size_t n, int *min, int *max);
+#endif
+
+size_t soa_capacity(size_t capacity)
+{
+	return capacity + (SOA_CAPACITY_ALIGN - capacity % SOA_CAPACITY_ALIGN) % SOA_CAPACITY_ALIGN;
+}
+
+size_t soa_buffer_size(size_t capacity)
+{
+	return capacity * SOA_ELEM_SIZE + 3 * SOA_DATA_OFFSET;
+}
+
+size_t amount_offset(size_t capacity)
+{
+	return capacity * sizeof(double) + 2 * SOA_DATA_OFFSET;
+}
+
+unsigned char *soa_buffer(struct SoaStack *stk)
+{
+	return (unsigned char*) stk->cost - SOA_DATA_OFFSET;
+}
+
+void set_arrays(struct SoaStack *stk, unsigned char *mem, size_t capacity)
+{
+	stk->capacity = capacity;
+	stk->cost = (double*) (mem + SOA_DATA_OFFSET);
+	stk->amount = (int*) (mem + amount_offset(capacity));
+}
+
+void poison_slots(struct SoaStack *stk, size_t from, size_t to)
+{
+	memset(stk->cost + from, POISON, (to - from) * sizeof(double));
+	memset(stk->amount + from, POISON, (to - from) * sizeof(int));
+}
+
+#ifdef CANARY_PROTECTION
+void set_data_canaries(struct SoaStack *stk)
+{
+	((canary_t*) stk->cost)[-1] = DEFAULT_CANARY;
+	((canary_t*) stk->amount)[-1] = DEFAULT_CANARY;
+	*((canary_t*) (stk->amount + stk->capacity)) = DEFAULT_CANARY;
+}
+#endif
+
+#ifdef HASH_PROTECTION
+unsigned long soa_slot_hash(struct SoaStack *stk, size_t index)
+{
+	return slot_hash(stk->cost + index, sizeof(double), index) +
+		   slot_hash(stk->amount + index, sizeof(int), index);
+}
+
+unsigned long soa_data_hash(struct SoaStack *stk)
+{
+	return slots_hash(stk->cost, sizeof(double), 0, stk->capacity) +
+		   slots_hash(stk->amount, sizeof(int), 0, stk->capacity);
+}
+
+void update_header_hash(struct SoaStack *stk)
+{
+	unsigned long data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	stk->hash = hash_bytes(stk, sizeof(SoaStack));
+	stk->data_hash = data_hash;
+}
+#endif
+
+/*
+* Growing reallocates in place and moves the amount array up to its new
+* offset. Shrinking copies into a fresh buffer instead, so a failed allocation
+* leaves the old layout intact.
+*/
+enum StackError resize_soa(struct SoaStack *stk, size_t capacity)
+{
+	capacity = soa_capacity(capacity);
+	size_t old_capacity = stk->capacity;
+	if (capacity == old_capacity)
+		return STACK_NO_ERR;
+
+	log_message(DEBUG, "reallocated soa stack from %lu to %lu\n", old_capacity, capacity);
+
+	unsigned char *old_mem = soa_buffer(stk);
+
+	if (capacity > old_capacity) {
+		unsigned char *mem = (unsigned char*) stk->allocator->reallocate(stk->allocator->ctx,
+										old_mem, soa_buffer_size(old_capacity),
+										soa_buffer_size(capacity));
+		if (!mem) return ERR_NO_MEM;
+
+		memmove(mem + amount_offset(capacity), mem + amount_offset(old_capacity),
+				old_capacity * sizeof(int));
+		set_arrays(stk, mem, capacity);
+		poison_slots(stk, old_capacity, capacity);
+	} else {
+		unsigned char *mem = (unsigned char*) stk->allocator->allocate(stk->allocator->ctx,
+																	   soa_buffer_size(capacity));
+		if (!mem) return ERR_NO_MEM;
+
+		const double *old_cost = stk->cost;
+		const int *old_amount = stk->amount;
+		set_arrays(stk, mem, capacity);
+		memcpy(stk->cost, old_cost, capacity * sizeof(double));
+		memcpy(stk->amount, old_amount, capacity * sizeof(int));
+
+		stk->allocator->deallocate(stk->allocator->ctx, old_mem, soa_buffer_size(old_capacity));
+	}
+
+#ifdef CANARY_PROTECTION
+	set_data_canaries(stk);
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->data_hash = soa_data_hash(stk);
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_ctor(struct SoaStack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname)
+{
+	int err = {};
+	if (!stk) {
+		err |= 1 << NULL_STACK_POINTER;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	PRINT_ELEM = print_elem;
+
+	if (stk->cost || stk->capacity != 0 || stk->size != 0) {
+		err |= 1 << DOUBLE_CTOR;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	stk->allocator = allocator ? allocator : DEFAULT_ALLOCATOR;
+
+	size_t capacity = soa_capacity(INIT_CAPACITY);
+	unsigned char *mem = (unsigned char*) stk->allocator->allocate(stk->allocator->ctx,
+																   soa_buffer_size(capacity));
+	if (mem == NULL) return ERR_NO_MEM;
+
+	stk->size = 0;
+	set_arrays(stk, mem, capacity);
+	poison_slots(stk, 0, capacity);
+
+	stk->filename = filename;
+	stk->line = line;
+	stk->varname = varname;
+	stk->funcname = funcname;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = DEFAULT_CANARY;
+	stk->right_canary = DEFAULT_CANARY;
+	set_data_canaries(stk);
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->data_hash = soa_data_hash(stk);
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_dtor(struct SoaStack *stk)
+{
+	VALIDATE_STACK_FULL(stk);
+
+	stk->allocator->deallocate(stk->allocator->ctx, soa_buffer(stk),
+							   soa_buffer_size(stk->capacity));
+
+	stk->size = 0;
+	stk->capacity = 0;
+	stk->cost = NULL;
+	stk->amount = NULL;
+	stk->allocator = NULL;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = 0;
+	stk->right_canary = 0;
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->hash = 0;
+	stk->data_hash = 0;
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_push(struct SoaStack *stk, elem_t value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == stk->capacity) {
+		enum StackError error = resize_soa(stk, stk->capacity * MULTIPLIER);
+		if (error < 0) return error;
+	}
+
+	size_t index = stk->size++;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = soa_slot_hash(stk, index);
+#endif
+
+	stk->cost[index] = value.cost;
+	stk->amount[index] = value.amount;
+
+#ifdef HASH_PROTECTION
+	stk->data_hash += soa_slot_hash(stk, index) - old_slot_hash;
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_pop(struct SoaStack *stk, elem_t *value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	size_t index = --stk->size;
+	value->cost = stk->cost[index];
+	value->amount = stk->amount[index];
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = soa_slot_hash(stk, index);
+#endif
+
+	poison_slots(stk, index, index + 1);
+
+#ifdef HASH_PROTECTION
+	stk->data_hash += soa_slot_hash(stk, index) - old_slot_hash;
+	update_header_hash(stk);
+#endif
+
+	// a failed shrink only leaves the bigger buffer in place, the pop itself is done
+	if (stk->size * SHRINK_COEF <= stk->capacity && stk->capacity > soa_capacity(INIT_CAPACITY))
+		resize_soa(stk, stk->capacity / MULTIPLIER);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_reserve(struct SoaStack *stk, size_t capacity)
+{
+	VALIDATE_STACK(stk);
+
+	if (capacity <= stk->capacity)
+		return STACK_NO_ERR;
+
+	return resize_soa(stk, capacity);
+}
+
+//-----------------------------
+
+double stack_cost_sum(struct SoaStack *stk)
+{
+	VALIDATE_STACK(stk);
+	return soa_kernels()->sum_double(stk->cost, stk->size);
+}
+
+long long stack_amount_sum(struct SoaStack *stk)
+{
+	VALIDATE_STACK(stk);
+	return soa_kernels()->sum_int(stk->amount, stk->size);
+}
+
+double stack_weighted_sum(struct SoaStack *stk)
+{
+	VALIDATE_STACK(stk);
+	return soa_kernels()->dot(stk->cost, stk->amount, stk->size);
+}
+
+enum StackError stack_cost_range(struct SoaStack *stk, double *min, double *max)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	soa_kernels()->range_double(stk->cost, stk->size, min, max);
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_amount_range(struct SoaStack *stk, int *min, int *max)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	soa_kernels()->range_int(stk->amount, stk->size, min, max);
+	return STACK_NO_ERR;
+}
+
+// four independent accumulators, so even the portable loop isn't latency-bound
+double sum_double_scalar(const double *values, size_t n)
+{
+	double sums[4] = {};
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		for (size_t j = 0; j < 4; j++)
+			sums[j] += values[i + j];
+
+	for (; i < n; i++)
+		sums[0] += values[i];
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+long long sum_int_scalar(const int *values, size_t n)
+{
+	long long sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += values[i];
+
+	return sum;
+}
+
+double dot_scalar(const double *costs, const int *amounts, size_t n)
+{
+	double sums[4] = {};
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		for (size_t j = 0; j < 4; j++)
+			sums[j] += costs[i + j] * amounts[i + j];
+
+	for (; i < n; i++)
+		sums[0] += costs[i] * amounts[i];
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+void range_double_scalar(const double *values, size_t n, double *min, double *max)
+{
+	*min = values[0];
+	*max = values[0];
+	for (size_t i = 1; i < n; i++) {
+		if (values[i] < *min) *min = values[i];
+		if (values[i] > *max) *max = values[i];
+	}
+}
+
+void range_int_scalar(const int *values, size_t n, int *min, int *max)
+{
+	*min = values[0];
+	*max = values[0];
+	for (size_t i = 1; i < n; i++) {
+		if (values[i] < *min) *min = values[i];
+		if (values[i] > *max) *max = values[i];
+	}
+}
+
+#ifdef SOA_X86
+__attribute__((target("avx2")))
+double sum_double_avx2(const double *values, size_t n)
+{
+	__m256d sum0 = _mm256_setzero_pd();
+	__m256d sum1 = _mm256_setzero_pd();
+	__m256d sum2 = _mm256_setzero_pd();
+	__m256d sum3 = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(values + i));
+		sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(values + i + 4));
+		sum2 = _mm256_add_pd(sum2, _mm256_loadu_pd(values + i + 8));
+		sum3 = _mm256_add_pd(sum3, _mm256_loadu_pd(values + i + 12));
+	}
+
+	double lanes[4] = {};
+	_mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3)));
+
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sum_double_scalar(values + i, n - i);
+}
+
+__attribute__((target("avx2")))
+long long sum_int_avx2(const int *values, size_t n)
+{
+	__m256i sum0 = _mm256_setzero_si256();
+	__m256i sum1 = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (values + i));
+		sum0 = _mm256_add_epi64(sum0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(chunk)));
+		sum1 = _mm256_add_epi64(sum1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(chunk, 1)));
+	}
+
+	long long lanes[4] = {};
+	_mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(sum0, sum1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_int_scalar(values + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double dot_avx2(const double *costs, const int *amounts, size_t n)
+{
+	__m256d sum0 = _mm256_setzero_pd();
+	__m256d sum1 = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256d amount0 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*) (amounts + i)));
+		__m256d amount1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*) (amounts + i + 4)));
+		sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(costs + i), amount0));
+		sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(costs + i + 4), amount1));
+	}
+
+	double lanes[4] = {};
+	_mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + dot_scalar(costs + i, amounts + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void range_double_avx2(const double *values, size_t n, double *min, double *max)
+{
+	range_double_scalar(values, n < 4 ? n : 4, min, max);
+	if (n < 4) return;
+
+	__m256d mins = _mm256_loadu_pd(values);
+	__m256d maxs = mins;
+
+	size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256d chunk = _mm256_loadu_pd(values + i);
+		mins = _mm256_min_pd(mins, chunk);
+		maxs = _mm256_max_pd(maxs, chunk);
+	}
+
+	double lane_mins[4] = {};
+	double lane_maxs[4] = {};
+	_mm256_storeu_pd(lane_mins, mins);
+	_mm256_storeu_pd(lane_maxs, maxs);
+
+	for (size_t j = 0; j < 4; j++) {
+		if (lane_mins[j] < *min) *min = lane_mins[j];
+		if (lane_maxs[j] > *max) *max = lane_maxs[j];
+	}
+
+	for (; i < n; i++) {
+		if (values[i] < *min) *min = values[i];
+		if (values[i] > *max) *max = values[i];
+	}
+}
+
+__attribute__((target("avx2")))
+void range_int_avx2(const int *values, size_t n, int *min, int *max)
+{
+	range_int_scalar(values, n < 8 ? n : 8, min, max);
+	if (n < 8) return;
+
+	__m256i mins = _mm256_loadu_si256((const __m256i*) values);
+	__m256i maxs = mins;
+
+	size_t i = 8;
+	for (; i + 8 <= n; i += 8) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (values + i));
+		mins = _mm256_min_epi32(mins, chunk);
+		maxs = _mm256_max_epi32(maxs, chunk);
+	}
+
+	int lane_mins[8] = {};
+	int lane_maxs[8] = {};
+	_mm256_storeu_si256((__m256i*) lane_mins, mins);
+	_mm256_storeu_si256((__m256i*) lane_maxs, maxs);
+
+	for (size_t j = 0; j < 8; j++) {
+		if (lane_mins[j] < *min) *min = lane_mins[j];
+		if (lane_maxs[j] > *max) *max = lane_maxs[j];
+	}
+
+	for (; i < n; i++) {
+		if (values[i] < *min) *min = values[i];
+		if (values[i] > *max) *max = values[i];
+	}
+}
+#endif
+
+struct Soa_kernels select_soa_kernels()
+{
+	const struct Soa_kernels scalar = {
+		"scalar", sum_double_scalar, sum_int_scalar, dot_scalar,
+		range_double_scalar, range_int_scalar
+	};
+
+#ifdef SOA_X86
+	const struct Soa_kernels avx2 = {
+		"avx2", sum_double_avx2, sum_int_avx2, dot_avx2,
+		range_double_avx2, range_int_avx2
+	};
+
+	__builtin_cpu_init();
+	const char *forced = getenv("STACK_SOA_KERNEL");
+	if (__builtin_cpu_supports("avx2") && !(forced && strcmp(forced, "scalar") == 0))
+		return avx2;
+#endif
+
+	return scalar;
+}
+
+const struct Soa_kernels *soa_kernels()
+{
+	static const struct Soa_kernels kernels = select_soa_kernels();
+	return &kernels;
+}
+
+const char *soa_kernel()
+{
+	return soa_kernels()->name;
+}
+
+//-----------------------------
+
+bool is_poisoned_elem(struct SoaStack *stk, size_t index)
+{
+	return is_poisoned(stk->cost + index, sizeof(double)) &&
+		   is_poisoned(stk->amount + index, sizeof(int));
+}
+
+bool is_unpoisoned_elem(struct SoaStack *stk, size_t index)
+{
+	return !is_poisoned(stk->cost + index, sizeof(double)) ||
+		   !is_poisoned(stk->amount + index, sizeof(int));
+}
+
+enum StackError validate_stack_header(struct SoaStack *stk, int *err)
+{
+	*err = 0;
+
+	if (!stk) {
+		*err |= 1 << NULL_STACK_POINTER;
+		return STACK_FAILED;
+	}
+
+	if (!stk->cost || !stk->amount)
+		*err |= 1 << NULL_DATA_POINTER;
+
+	if (stk->size > stk->capacity)
+		*err |= 1 << CAPACITY_OVERFLOW;
+
+	if (stk->capacity == 0 || stk->capacity % SOA_CAPACITY_ALIGN != 0 || (stk->cost &&
+		(unsigned char*) stk->amount != soa_buffer(stk) + amount_offset(stk->capacity)))
+		*err |= 1 << SMALL_CAPACITY;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_hash = stk->hash;
+	unsigned long old_data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	if (old_hash != hash_bytes(stk, sizeof(SoaStack)))
+		*err |= 1 << WRONG_HASH;
+	stk->hash = old_hash;
+	stk->data_hash = old_data_hash;
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY)
+		*err |= 1 << LEFT_CANARY_BAD;
+
+	if (stk->right_canary != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_CANARY_BAD;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+
+#ifdef CANARY_PROTECTION
+	if (((canary_t*) stk->cost)[-1] != DEFAULT_CANARY)
+		*err |= 1 << LEFT_DATA_CANARY_BAD;
+
+	if (((canary_t*) stk->amount)[-1] != DEFAULT_CANARY ||
+		*((canary_t*) (stk->amount + stk->capacity)) != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_DATA_CANARY_BAD;
+#endif
+
+	if (stk->size > 0 && is_poisoned_elem(stk, stk->size - 1))
+		*err |= 1 << POISONED_VALUE;
+
+	if (stk->size < stk->capacity && is_unpoisoned_elem(stk, stk->size))
+		*err |= 1 << UNPOISONED_VALUE;
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+enum StackError validate_stack(struct SoaStack *stk, int *err)
+{
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+	// only elements whose cost is all POISON need their amount checked
+	for (size_t i = 0; i < stk->size; i++) {
+		i += find_poisoned(stk->cost + i, stk->size - i, sizeof(double));
+		if (i < stk->size && is_poisoned(stk->amount + i, sizeof(int))) {
+			*err |= 1 << POISONED_VALUE;
+			break;
+		}
+	}
+
+	size_t unused = stk->capacity - stk->size;
+	if (find_unpoisoned(stk->cost + stk->size, unused, sizeof(double)) < unused ||
+		find_unpoisoned(stk->amount + stk->size, unused, sizeof(int)) < unused)
+		*err |= 1 << UNPOISONED_VALUE;
+
+#ifdef HASH_PROTECTION
+	if (soa_data_hash(stk) != stk->data_hash)
+		*err |= 1 << WRONG_DATA_HASH;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+// aggregates already cost O(n), so only the O(1) checks run on every operation
+enum StackError validate_stack_op(struct SoaStack *stk, int *err)
+{
+	return validate_stack_header(stk, err);
+}
+
+void stack_dump(struct SoaStack *stk)
+{
+	if (!LOG_ENABLED(DEBUG)) return;
+
+	const size_t POISONED_MAX = 20;
+	log_message(DEBUG, "Stack [%p]\n", stk);
+
+	if (!stk) return;
+
+	log_string(DEBUG, "\t\"%s\" from %s (%d) %s()\n", stk->varname, stk->filename,
+			   stk->line, stk->funcname);
+	log_string(DEBUG, "\t{\n\t\tsize = %lu\n\t\tcapacity = %lu\n"
+			   "\t\tcost [%p]\n\t\tamount [%p]\n",
+			   stk->size, stk->capacity, stk->cost, stk->amount);
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\tleft canary = 0x%llX\n", stk->left_canary);
+	log_string(DEBUG, "\t\tright canary = 0x%llX\n", stk->right_canary);
+#endif
+
+#ifdef HASH_PROTECTION
+	log_string(DEBUG, "\t\thash = 0x%lX\n", stk->hash);
+	log_string(DEBUG, "\t\tdata hash = 0x%lX\n", stk->data_hash);
+#endif
+
+	if (!stk->cost || !stk->amount || stk->size > stk->capacity) {
+		log_string(DEBUG, "\t}\n");
+		return;
+	}
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY || stk->right_canary != DEFAULT_CANARY) {
+		log_string(DEBUG, "\t}\n");
+		return;
+	}
+
+	log_string(DEBUG, "\t\tdata canaries = 0x%llX 0x%llX 0x%llX\n",
+			   ((canary_t*) stk->cost)[-1], ((canary_t*) stk->amount)[-1],
+			   *((canary_t*) (stk->amount + stk->capacity)));
+#endif
+
+	const size_t BUFF_SIZE = 1024;
+	char buffer[BUFF_SIZE] = {};
+	size_t end = stk->size + POISONED_MAX < stk->capacity ? stk->size + POISONED_MAX :
+															stk->capacity;
+
+	log_string(DEBUG, "\t\t{\n");
+	for (size_t i = 0; i < end; i++) {
+		elem_t value = { stk->cost[i], stk->amount[i] };
+		PRINT_ELEM(buffer, value, BUFF_SIZE);
+		log_string(DEBUG, i < stk->size ? "\t\t\t*[%lu] = " : "\t\t\t[%lu] = ", i);
+		log_string(DEBUG, "%s", buffer);
+		if (is_poisoned_elem(stk, i))
+			log_string(DEBUG, " (poison)");
+		log_string(DEBUG, "\n");
+	}
+	log_string(DEBUG, "\t\t}\n\t}\n");
+}
+
+void stack_report_fail(struct SoaStack *stk, int err,
+					   const char *filename, int line, const char *func_name)
+{
+	log_stack_failures(err, filename, line, func_name);
+	stack_dump(stk);
+	logger_flush();
+}
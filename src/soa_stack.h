@@ -0,0 +1,77 @@
+#ifndef SOA_STACK
+#define SOA_STACK
+
+#include "stack.h"
+
+#define SOA_STACK_CTOR(stk, print) stack_ctor((stk), (print), NULL, #stk, __LINE__, __FILE__,	\
+												  __func__)
+#define SOA_STACK_CTOR_ALLOC(stk, print, allocator) stack_ctor((stk), (print), (allocator),		\
+															   #stk, __LINE__, __FILE__,		\
+															   __func__)
+
+// capacities are kept a multiple of this, so the amount array ends 8-aligned
+const size_t SOA_CAPACITY_ALIGN = 8;
+
+/*
+* Stack of Elem stored as two arrays growing in lockstep: cost[capacity]
+* followed by amount[capacity] in one buffer (with a canary around each under
+* CANARY_PROTECTION). It takes 12 bytes per element instead of 16, and the
+* aggregates below run over contiguous doubles and ints with SIMD. An element
+* counts as poisoned when both of its fields are.
+*/
+struct SoaStack {
+#ifdef CANARY_PROTECTION
+	canary_t left_canary;
+#endif
+
+#ifdef HASH_PROTECTION
+	unsigned long hash;
+	unsigned long data_hash;
+#endif
+
+	size_t capacity;
+	size_t size;
+	double *cost;
+	int *amount;
+	const struct Stack_allocator *allocator;
+	const char *varname;
+	const char *filename;
+	const char *funcname;
+	int line;
+
+#ifdef CANARY_PROTECTION
+	canary_t right_canary;
+#endif
+};
+
+enum StackError stack_ctor(struct SoaStack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname);
+enum StackError stack_dtor(struct SoaStack *stk);
+enum StackError stack_push(struct SoaStack *stk, elem_t value);
+enum StackError stack_pop(struct SoaStack *stk, elem_t *value);
+enum StackError stack_reserve(struct SoaStack *stk, size_t capacity);
+
+/*
+* Aggregates over the used elements. Floating-point sums are accumulated in
+* several lanes, so they can differ from a sequential loop in the last bits.
+* Ranges return ERR_STACK_EMPTY for an empty stack; NaN costs give an
+* unspecified min/max.
+*/
+double stack_cost_sum(struct SoaStack *stk);
+long long stack_amount_sum(struct SoaStack *stk);
+// sum of cost * amount
+double stack_weighted_sum(struct SoaStack *stk);
+enum StackError stack_cost_range(struct SoaStack *stk, double *min, double *max);
+enum StackError stack_amount_range(struct SoaStack *stk, int *min, int *max);
+// AVX2 where the CPU has it; STACK_SOA_KERNEL=scalar forces the portable loops
+const char *soa_kernel();
+
+enum StackError validate_stack(struct SoaStack *stk, int *err);
+enum StackError validate_stack_op(struct SoaStack *stk, int *err);
+void stack_dump(struct SoaStack *stk);
+void stack_report_fail(struct SoaStack *stk, int err,
+					   const char *filename, int line, const char *func_name);
+
+#endif
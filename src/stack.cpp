@@ -1,16 +1,97 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "logger.h"
 #include "stack.h"
 #include "stack_debug.h"
+#include "allocators.h"
+#include "journal.h"
+
+#ifdef CANARY_PROTECTION
+const size_t DATA_OFFSET = sizeof(canary_t);
+#else
+const size_t DATA_OFFSET = 0;
+#endif
+
+// pops don't shrink below this: an inline stack has nothing smaller to move to
+#ifdef STACK_INLINE_CAPACITY
+const size_t MIN_CAPACITY = INLINE_CAPACITY;
+#else
+const size_t MIN_CAPACITY = INIT_CAPACITY;
+#endif
 
 enum StackError reallocate_stack(struct Stack *stk, size_t old_size, size_t new_size);
+elem_t *resize_buffer(struct Stack *stk, size_t old_size, size_t new_size);
+size_t grow_step(const struct Stack_policy *policy, size_t capacity);
+size_t shrink_step(const struct Stack_policy *policy, size_t capacity);
+size_t grown_capacity(const struct Stack_policy *policy, size_t capacity, size_t needed);
+bool is_oversized(const struct Stack_policy *policy, size_t size, size_t capacity);
+size_t shrink_limit(const struct Stack_policy *policy, size_t capacity, size_t floor);
+void count_oversized(struct Stack *stk, size_t ops);
+void shrink_stack(struct Stack *stk);
+enum StackError save_undo(struct Stack *stk, size_t from);
+void end_transaction(struct Stack *stk);
+size_t round_capacity(size_t capacity);
+size_t buffer_size(size_t capacity);
+void check_ctor(struct Stack *stk, print_func print_elem);
+void init_header(struct Stack *stk, const char *varname, int line, const char *filename,
+				 const char *funcname);
+bool is_valid_snapshot(struct Snapshot_header header, size_t file_size);
+bool read_header(FILE *file, struct Snapshot_header *header);
 
-enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
-						   const char *varname, int line, const char *filename,
-						   const char *funcname)
+#ifdef HASH_PROTECTION
+unsigned long replaced_hash(struct Stack *stk, size_t to);
+#endif
+
+size_t round_capacity(size_t capacity)
+{
+#ifdef CANARY_PROTECTION
+	capacity += (sizeof(canary_t) - capacity % sizeof(canary_t)) % sizeof(canary_t);
+#endif
+	return capacity;
+}
+
+size_t buffer_size(size_t capacity)
+{
+	return capacity * sizeof(elem_t) + 2 * DATA_OFFSET;
+}
+
+void stack_set_default_allocator(const struct Stack_allocator *allocator)
+{
+#ifdef GUARD_PROTECTION
+	DEFAULT_ALLOCATOR = allocator ? allocator : &GUARD_ALLOCATOR;
+#else
+	DEFAULT_ALLOCATOR = allocator ? allocator : &HEAP_ALLOCATOR;
+#endif
+}
+
+void default_validation(enum ValidationLevel *level, size_t *period)
+{
+	static bool is_read = false;
+	static enum ValidationLevel env_level = VALIDATE_FULL;
+	static size_t env_period = DEFAULT_VALIDATION_PERIOD;
+
+	if (!is_read) {
+		const char *level_str = getenv("STACK_VALIDATION");
+		if (level_str && strcmp(level_str, "header") == 0)
+			env_level = VALIDATE_HEADER;
+		else if (level_str && strcmp(level_str, "periodic") == 0)
+			env_level = VALIDATE_PERIODIC;
+
+		const char *period_str = getenv("STACK_VALIDATION_PERIOD");
+		if (period_str && strtoul(period_str, NULL, 10) > 0)
+			env_period = strtoul(period_str, NULL, 10);
+
+		is_read = true;
+	}
+
+	*level = env_level;
+	*period = env_period;
+}
+
+void check_ctor(struct Stack *stk, print_func print_elem)
 {
 	int err = {};
 	if (!stk) {
@@ -26,30 +107,27 @@ enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
 		STACK_REPORT_FAIL(stk, err);
 		abort();
 	}
+}
 
-	stk->size = 0;
-	stk->capacity = INIT_CAPACITY;
-	elem_t *mem = NULL;
-
-#ifdef CANARY_PROTECTION
-	stk->capacity += (sizeof(canary_t) - stk->capacity % sizeof(canary_t)) % sizeof(canary_t);
-	mem = (elem_t*) calloc(stk->capacity * sizeof(elem_t) + 2 * sizeof(canary_t),
-						   sizeof(char));
-	if (mem == NULL) return ERR_NO_MEM;
-	stk->data = (elem_t*) ((unsigned char*) mem + sizeof(canary_t));
-#else
-	mem = (elem_t*) calloc(stk->capacity, sizeof(elem_t));
-	if (mem == NULL) return ERR_NO_MEM;
-	stk->data = mem;
-#endif
-
-	memset(stk->data, POISON, stk->capacity * sizeof(elem_t));
-	
+// everything but the hash, once data, size and capacity are set
+void init_header(struct Stack *stk, const char *varname, int line, const char *filename,
+				 const char *funcname)
+{
+	stk->journal = NULL;
 	stk->filename = filename;
 	stk->line = line;
 	stk->varname = varname;
 	stk->funcname = funcname;
 
+	default_validation(&stk->validation, &stk->validation_period);
+	stk->ops_since_check = 0;
+	stk->policy = DEFAULT_POLICY;
+	stk->reserved = 0;
+	stk->shrink_limit = shrink_limit(&stk->policy, stk->capacity, stk->reserved);
+	stk->oversized_ops = 0;
+	stk->transaction = {};
+	stk->stats = {};
+
 #ifdef CANARY_PROTECTION
 	stk->left_canary = DEFAULT_CANARY;
 	stk->right_canary = DEFAULT_CANARY;
@@ -57,6 +135,38 @@ enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
 	*((canary_t*) (stk->data + stk->capacity)) = DEFAULT_CANARY;
 #endif
 
+#ifdef GUARD_PROTECTION
+	if (stk->allocator == &GUARD_ALLOCATOR)
+		guard_register(stk);
+#endif
+}
+
+enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname)
+{
+	check_ctor(stk, print_elem);
+
+	stk->size = 0;
+	stk->allocator = allocator ? allocator : DEFAULT_ALLOCATOR;
+
+#ifdef STACK_INLINE_CAPACITY
+	stk->capacity = INLINE_CAPACITY;
+	stk->data = inline_data(stk);
+#else
+	stk->capacity = round_capacity(INIT_CAPACITY);
+
+	unsigned char *mem = (unsigned char*) stk->allocator->allocate(stk->allocator->ctx,
+																   buffer_size(stk->capacity));
+	if (mem == NULL) return ERR_NO_MEM;
+	stk->data = (elem_t*) (mem + DATA_OFFSET);
+#endif
+
+	memset(stk->data, POISON, stk->capacity * sizeof(elem_t));
+	
+	init_header(stk, varname, line, filename, funcname);
+
 #ifdef HASH_PROTECTION
 	update_hash(stk);
 #endif
@@ -66,21 +176,42 @@ enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
 
 enum StackError stack_dtor(struct Stack *stk)
 {
-	VALIDATE_STACK(stk);
+	if (stk && stk->transaction.is_active)
+		stack_rollback(stk);
+
+	VALIDATE_STACK_FULL(stk);
+
+	if (stk->journal != NULL)
+		journal_commit(stk->journal);
+	stk->journal = NULL;
+
+#ifdef GUARD_PROTECTION
+	guard_unregister(stk);
+#endif
 	
+#ifdef STACK_INLINE_CAPACITY
+	bool is_allocated = !is_inline_data(stk);
+#else
+	bool is_allocated = true;
+#endif
+
+	if (is_allocated)
+		stk->allocator->deallocate(stk->allocator->ctx, (unsigned char*) stk->data - DATA_OFFSET,
+								   buffer_size(stk->capacity));
+
+	free(stk->transaction.undo);
+	stk->transaction = {};
+
 	stk->size = 0;
 	stk->capacity = 0;
+	stk->data = NULL;
+	stk->allocator = NULL;
 
 #ifdef CANARY_PROTECTION
 	stk->right_canary = 0;
 	stk->left_canary = 0;
-	free((unsigned char*) stk->data - sizeof(canary_t));
-#else
-	free(stk->data);
 #endif
 
-	stk->data = NULL;
-
 #ifdef HASH_PROTECTION
 	stk->hash = 0;
 	stk->data_hash = 0;
@@ -95,54 +226,207 @@ enum StackError reallocate_stack(struct Stack *stk, size_t old_size, size_t new_
 
 	log_message(DEBUG, "reallocated stack from %lu to %lu\n", old_size, new_size);
 
-	elem_t *mem = NULL;
-
-#ifdef CANARY_PROTECTION
-	new_size += (sizeof(canary_t) - new_size % sizeof(canary_t)) % sizeof(canary_t);
+	new_size = round_capacity(new_size);
+#ifdef STACK_INLINE_CAPACITY
+	if (new_size <= INLINE_CAPACITY)
+		new_size = INLINE_CAPACITY;
+#endif
 	if (new_size == old_size)
 		return STACK_NO_ERR;
-	
-	mem = (elem_t*) realloc((unsigned char*) stk->data - sizeof(canary_t),
-							new_size * sizeof(elem_t) + 2 * sizeof(canary_t));
-	if (!mem) return ERR_NO_MEM;
-	stk->data = (elem_t*) ((unsigned char*) mem + sizeof(canary_t));
-#else
-	mem = (elem_t*) realloc(stk->data, new_size * sizeof(elem_t));
-	if (!mem) return ERR_NO_MEM;
-	stk->data = mem;
-#endif
+
+	elem_t *old_data = stk->data;
+	elem_t *data = resize_buffer(stk, old_size, new_size);
+	if (!data) return ERR_NO_MEM;
+	stk->data = data;
+
+	count_stat(stk, new_size > old_size ? STAT_GROWS : STAT_SHRINKS, 1);
+	if (data != old_data)
+		count_stat(stk, STAT_BYTES_MOVED, buffer_size(old_size < new_size ? old_size : new_size));
 
 	stk->capacity = new_size;
+	stk->shrink_limit = shrink_limit(&stk->policy, new_size, stk->reserved);
 	if (new_size > old_size)
 		memset(stk->data + old_size, POISON, (new_size - old_size) * sizeof(elem_t));
 
+	// a transaction only grows the buffer: its saved hash takes the new poisoned slots
 #ifdef HASH_PROTECTION
-	update_hash(stk);
+	if (stk->transaction.is_active)
+		stk->transaction.data_hash += range_hash(stk, old_size, new_size);
+	else
+		update_hash(stk);
 #endif
 
 #ifdef CANARY_PROTECTION
+	((canary_t*) stk->data)[-1] = DEFAULT_CANARY;
 	*((canary_t*) (stk->data + stk->capacity)) = DEFAULT_CANARY;
 #endif
 
 	return STACK_NO_ERR;
 }
 
+// the allocator never sees the inline buffer: data is copied out of and back into it
+elem_t *resize_buffer(struct Stack *stk, size_t old_size, size_t new_size)
+{
+	unsigned char *old_mem = (unsigned char*) stk->data - DATA_OFFSET;
+
+#ifdef STACK_INLINE_CAPACITY
+	size_t kept = old_size < new_size ? old_size : new_size;
+
+	if (new_size == INLINE_CAPACITY) {
+		memcpy(inline_data(stk), stk->data, kept * sizeof(elem_t));
+		stk->allocator->deallocate(stk->allocator->ctx, old_mem, buffer_size(old_size));
+		return inline_data(stk);
+	}
+
+	if (is_inline_data(stk)) {
+		unsigned char *mem = (unsigned char*) stk->allocator->allocate(stk->allocator->ctx,
+																	   buffer_size(new_size));
+		if (!mem) return NULL;
+
+		memcpy(mem + DATA_OFFSET, stk->data, kept * sizeof(elem_t));
+		return (elem_t*) (mem + DATA_OFFSET);
+	}
+#endif
+
+	unsigned char *mem = (unsigned char*) stk->allocator->reallocate(stk->allocator->ctx,
+									old_mem, buffer_size(old_size), buffer_size(new_size));
+	return mem ? (elem_t*) (mem + DATA_OFFSET) : NULL;
+}
+
+//-----------------------------
+
+size_t grow_step(const struct Stack_policy *policy, size_t capacity)
+{
+	size_t next = policy->growth == GROW_INCREMENT ? capacity + policy->increment :
+					(size_t) ((double) capacity * policy->factor);
+
+	return next > capacity ? next : capacity + 1;
+}
+
+size_t shrink_step(const struct Stack_policy *policy, size_t capacity)
+{
+	size_t prev = policy->growth == GROW_INCREMENT ?
+					(capacity > policy->increment ? capacity - policy->increment : 0) :
+					(size_t) ((double) capacity / policy->factor);
+
+	if (prev >= capacity)
+		prev = capacity - 1;
+	return prev > MIN_CAPACITY ? prev : MIN_CAPACITY;
+}
+
+size_t grown_capacity(const struct Stack_policy *policy, size_t capacity, size_t needed)
+{
+	while (capacity < needed)
+		capacity = grow_step(policy, capacity);
+
+	return capacity;
+}
+
+// the capacity one step down would still take a whole growth step of pushes
+bool is_oversized(const struct Stack_policy *policy, size_t size, size_t capacity)
+{
+	return capacity > MIN_CAPACITY && grow_step(policy, size) <= shrink_step(policy, capacity);
+}
+
+// is_oversized is monotonic in size, so it is cached per capacity as a size limit;
+// nothing shrinks at or below floor
+size_t shrink_limit(const struct Stack_policy *policy, size_t capacity, size_t floor)
+{
+	if (capacity <= MIN_CAPACITY || capacity <= floor)
+		return 0;
+
+	size_t prev = shrink_step(policy, capacity);
+	size_t low = 0;
+	size_t high = prev;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (grow_step(policy, mid) <= prev)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+void count_oversized(struct Stack *stk, size_t ops)
+{
+	if (stk->size < stk->shrink_limit)
+		stk->oversized_ops += ops;
+	else
+		stk->oversized_ops = 0;
+}
+
+// a failed shrink only leaves the bigger buffer in place, the pop itself is done
+void shrink_stack(struct Stack *stk)
+{
+	const struct Stack_policy *policy = &stk->policy;
+	if (policy->shrink == SHRINK_NEVER)
+		return;
+	if (policy->shrink == SHRINK_DELAYED && stk->oversized_ops < policy->shrink_delay)
+		return;
+	if (stk->size >= stk->shrink_limit)
+		return;
+
+	size_t capacity = stk->capacity;
+	while (capacity > stk->reserved && is_oversized(policy, stk->size, capacity))
+		capacity = shrink_step(policy, capacity);
+	if (capacity < stk->reserved)
+		capacity = stk->reserved;
+
+	if (capacity == stk->capacity)
+		return;
+
+	reallocate_stack(stk, stk->capacity, capacity);
+
+	if (stk->oversized_ops != 0) {
+		stk->oversized_ops = 0;
+#ifdef HASH_PROTECTION
+		update_header_hash(stk);
+#endif
+	}
+}
+
 enum StackError stack_push(struct Stack *stk, elem_t value)
 {
 	VALIDATE_STACK(stk);
 
 	if (stk->size == stk->capacity) {
 		enum StackError error = reallocate_stack(stk, stk->capacity,
-												 stk->capacity * MULTIPLIER);
+								grown_capacity(&stk->policy, stk->capacity, stk->size + 1));
 		if (error < 0) return error;
 	}
 
-	stk->data[stk->size++] = value;
+	if (stk->transaction.is_active) {
+		stk->data[stk->size++] = value;
+		count_stat(stk, STAT_PUSHES, 1);
+		count_size(stk);
+		if (stk->size > stk->transaction.high)
+			stk->transaction.high = stk->size;
+
+		return STACK_NO_ERR;
+	}
 
 #ifdef HASH_PROTECTION
-	update_hash(stk);
+	unsigned long old_slot_hash = slot_hash(stk->data + stk->size, sizeof(elem_t),
+											stk->size);
 #endif
 
+	size_t index = stk->size++;
+	stk->data[index] = value;
+
+	count_stat(stk, STAT_PUSHES, 1);
+	count_size(stk);
+	if (stk->policy.shrink == SHRINK_DELAYED)
+		count_oversized(stk, 1);
+
+#ifdef HASH_PROTECTION
+	update_slot_hash(stk, index, old_slot_hash);
+#endif
+
+	if (stk->journal != NULL && journal_record(stk, JOURNAL_PUSH, &value, 1) != STACK_NO_ERR)
+		return ERR_NOT_DURABLE;
+
 	return STACK_NO_ERR;
 }
 
@@ -150,20 +434,555 @@ enum StackError stack_pop(struct Stack *stk, elem_t *value)
 {
 	VALIDATE_STACK(stk);
 
-	if (stk->size * SHRINK_COEF <= stk->capacity && stk->capacity > INIT_CAPACITY) {
-		enum StackError error = reallocate_stack(stk, stk->capacity, 
-												 stk->capacity / MULTIPLIER);
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	if (stk->transaction.is_active) {
+		if (stk->size <= stk->transaction.low) {
+			enum StackError error = save_undo(stk, stk->size - 1);
+			if (error != STACK_NO_ERR) return error;
+		}
+
+		*value = stk->data[--stk->size];
+		count_stat(stk, STAT_POPS, 1);
+
+		return STACK_NO_ERR;
+	}
+
+	size_t index = --stk->size;
+	*value = stk->data[index];
+
+	count_stat(stk, STAT_POPS, 1);
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = slot_hash(stk->data + index, sizeof(elem_t), index);
+#endif
+
+	memset(stk->data + index, POISON, sizeof(elem_t));
+	if (stk->policy.shrink == SHRINK_DELAYED)
+		count_oversized(stk, 1);
+
+#ifdef HASH_PROTECTION
+	update_slot_hash(stk, index, old_slot_hash);
+#endif
+
+	shrink_stack(stk);
+
+	if (stk->journal != NULL && journal_record(stk, JOURNAL_POP, NULL, 1) != STACK_NO_ERR)
+		return ERR_NOT_DURABLE;
+
+	return STACK_NO_ERR;
+}
+
+// the reserved capacity stays as a floor for pops until stack_shrink_to_fit
+enum StackError stack_reserve(struct Stack *stk, size_t capacity)
+{
+	VALIDATE_STACK(stk);
+
+	if (capacity > stk->capacity) {
+		enum StackError error = reallocate_stack(stk, stk->capacity, capacity);
+		if (error != STACK_NO_ERR) return error;
+	}
+
+	if (capacity > stk->reserved) {
+		stk->reserved = capacity;
+		stk->shrink_limit = shrink_limit(&stk->policy, stk->capacity, stk->reserved);
+#ifdef HASH_PROTECTION
+		update_header_hash(stk);
+#endif
+	}
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_push_n(struct Stack *stk, const elem_t *values, size_t n)
+{
+	VALIDATE_STACK(stk);
+
+	if (n == 0) return STACK_NO_ERR;
+
+	if (stk->size + n > stk->capacity) {
+		enum StackError error = reallocate_stack(stk, stk->capacity,
+								grown_capacity(&stk->policy, stk->capacity, stk->size + n));
 		if (error < 0) return error;
 	}
 
-	if (stk->size == 0) return ERR_STACK_EMPTY;
+#ifdef HASH_PROTECTION
+	unsigned long old_range_hash = stk->transaction.is_active ? 0 :
+								   range_hash(stk, stk->size, stk->size + n);
+#endif
 
-	*value = stk->data[--stk->size];
-	memset(stk->data + stk->size, POISON, sizeof(elem_t));
+	size_t from = stk->size;
+	memcpy(stk->data + from, values, n * sizeof(elem_t));
+	stk->size += n;
+
+	if (stk->transaction.is_active) {
+		count_stat(stk, STAT_PUSHES, n);
+		count_size(stk);
+		if (stk->size > stk->transaction.high)
+			stk->transaction.high = stk->size;
+
+		return STACK_NO_ERR;
+	}
+
+	count_stat(stk, STAT_PUSHES, n);
+	count_size(stk);
+	if (stk->policy.shrink == SHRINK_DELAYED)
+		count_oversized(stk, n);
+
+#ifdef HASH_PROTECTION
+	update_range_hash(stk, from, stk->size, old_range_hash);
+#endif
+
+	if (stk->journal != NULL && journal_record(stk, JOURNAL_PUSH, values, n) != STACK_NO_ERR)
+		return ERR_NOT_DURABLE;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_pop_n(struct Stack *stk, elem_t *values, size_t n)
+{
+	VALIDATE_STACK(stk);
+
+	if (n > stk->size) return ERR_STACK_EMPTY;
+	if (n == 0) return STACK_NO_ERR;
+
+	size_t from = stk->size - n;
+	if (stk->transaction.is_active && from < stk->transaction.low) {
+		enum StackError error = save_undo(stk, from);
+		if (error != STACK_NO_ERR) return error;
+	}
+
+	if (values != NULL)
+		memcpy(values, stk->data + from, n * sizeof(elem_t));
+
+	if (stk->transaction.is_active) {
+		stk->size = from;
+		count_stat(stk, STAT_POPS, n);
+
+		return STACK_NO_ERR;
+	}
+
+#ifdef HASH_PROTECTION
+	unsigned long old_range_hash = range_hash(stk, from, stk->size);
+#endif
+
+	memset(stk->data + from, POISON, n * sizeof(elem_t));
+	stk->size = from;
+
+	count_stat(stk, STAT_POPS, n);
+	if (stk->policy.shrink == SHRINK_DELAYED)
+		count_oversized(stk, n);
+
+#ifdef HASH_PROTECTION
+	update_range_hash(stk, from, from + n, old_range_hash);
+#endif
+
+	shrink_stack(stk);
+
+	if (stk->journal != NULL && journal_record(stk, JOURNAL_POP, NULL, n) != STACK_NO_ERR)
+		return ERR_NOT_DURABLE;
+
+	return STACK_NO_ERR;
+}
+
+// only the header moves, so the inline buffer and the guard table entry need fixing up
+enum StackError stack_move(struct Stack *dst, struct Stack *src)
+{
+	check_ctor(dst, PRINT_ELEM);
+	VALIDATE_STACK(src);
+
+	*dst = *src;
+
+#ifdef STACK_INLINE_CAPACITY
+	if (is_inline_data(src))
+		dst->data = inline_data(dst);
+#endif
+
+#ifdef GUARD_PROTECTION
+	guard_unregister(src);
+	if (dst->allocator == &GUARD_ALLOCATOR)
+		guard_register(dst);
+#endif
+
+#ifdef HASH_PROTECTION
+	update_header_hash(dst);
+#endif
+
+	memset(src, 0, sizeof(*src));
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_shrink_to_fit(struct Stack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->transaction.is_active) return STACK_FAILED;
+
+	stk->reserved = 0;
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return reallocate_stack(stk, stk->capacity, stk->size > MIN_CAPACITY ? stk->size : MIN_CAPACITY);
+}
+
+enum StackError stack_set_policy(struct Stack *stk, struct Stack_policy policy)
+{
+	if (stk && stk->transaction.is_active) return STACK_FAILED;
+
+	VALIDATE_STACK_FULL(stk);
+
+	if (policy.growth == GROW_GEOMETRIC &&
+		!(policy.factor > 1.0 && policy.factor <= MAX_GROWTH_FACTOR))
+		return STACK_FAILED;
+	if (policy.growth == GROW_INCREMENT && policy.increment == 0)
+		return STACK_FAILED;
+	if (policy.growth != GROW_GEOMETRIC && policy.growth != GROW_INCREMENT)
+		return STACK_FAILED;
+	if (policy.shrink != SHRINK_STEP && policy.shrink != SHRINK_NEVER &&
+		policy.shrink != SHRINK_DELAYED)
+		return STACK_FAILED;
+
+	stk->policy = policy;
+	stk->shrink_limit = shrink_limit(&stk->policy, stk->capacity, stk->reserved);
+	stk->oversized_ops = 0;
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_set_validation(struct Stack *stk, enum ValidationLevel level,
+									 size_t period)
+{
+	if (stk && stk->transaction.is_active) return STACK_FAILED;
+
+	VALIDATE_STACK_FULL(stk);
+
+	stk->validation = level;
+	stk->validation_period = period > 0 ? period : 1;
+	stk->ops_since_check = 0;
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+//-----------------------------
+
+// keeps the elements of [from, low) before a pop inside a transaction lets pushes overwrite them
+enum StackError save_undo(struct Stack *stk, size_t from)
+{
+	struct Stack_transaction *tx = &stk->transaction;
+
+	size_t needed = tx->size - from;
+	if (needed > tx->undo_capacity) {
+		size_t capacity = tx->undo_capacity * MULTIPLIER;
+		if (capacity < needed)
+			capacity = needed;
+
+		elem_t *undo = (elem_t*) realloc(tx->undo, capacity * sizeof(elem_t));
+		if (undo == NULL) return ERR_NO_MEM;
+
+		tx->undo = undo;
+		tx->undo_capacity = capacity;
+	}
+
+	for (size_t i = tx->low; i > from; i--)
+		tx->undo[tx->size - i] = stk->data[i - 1];
+	tx->low = from;
+
+	return STACK_NO_ERR;
+}
+
+void end_transaction(struct Stack *stk)
+{
+	struct Stack_transaction *tx = &stk->transaction;
+
+	if (tx->high > stk->size)
+		memset(stk->data + stk->size, POISON, (tx->high - stk->size) * sizeof(elem_t));
+	tx->is_active = false;
+}
+
+#ifdef HASH_PROTECTION
+// what slots [low, to) hashed to at stack_begin: popped elements, then poison
+unsigned long replaced_hash(struct Stack *stk, size_t to)
+{
+	struct Stack_transaction *tx = &stk->transaction;
+	elem_t poison = {};
+	memset(&poison, POISON, sizeof(poison));
+
+	unsigned long hash = 0;
+	for (size_t i = tx->low; i < to; i++)
+		hash += slot_hash(i < tx->size ? tx->undo + (tx->size - 1 - i) : &poison,
+						  sizeof(elem_t), i);
+
+	return hash;
+}
+#endif
+
+enum StackError stack_begin(struct Stack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	struct Stack_transaction *tx = &stk->transaction;
+	if (tx->is_active) return STACK_FAILED;
+
+	tx->is_active = true;
+	tx->size = stk->size;
+	tx->low = stk->size;
+	tx->high = stk->size;
+
+#ifdef HASH_PROTECTION
+	tx->data_hash = stk->data_hash;
+#endif
+
+	return STACK_NO_ERR;
+}
+
+// the first check only catches a NULL stk: validation is off until the transaction ends
+enum StackError stack_commit(struct Stack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	struct Stack_transaction *tx = &stk->transaction;
+	if (!tx->is_active) return STACK_FAILED;
+
+	end_transaction(stk);
+
+	// slots below low and above both sizes are as they were at stack_begin
+#ifdef HASH_PROTECTION
+	size_t to = stk->size > tx->size ? stk->size : tx->size;
+	stk->data_hash = tx->data_hash;
+	update_range_hash(stk, tx->low, to, replaced_hash(stk, to));
+#endif
+
+	if (validate_stack_op(stk, &err) == STACK_FAILED) {
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	shrink_stack(stk);
+
+	if (stk->journal != NULL && (tx->low < tx->size || tx->low < stk->size) &&
+		journal_record_change(stk, tx->size - tx->low, stk->data + tx->low,
+							  stk->size - tx->low) != STACK_NO_ERR)
+		return ERR_NOT_DURABLE;
+
+	return STACK_NO_ERR;
+}
+
+enum StackError stack_rollback(struct Stack *stk)
+{
+	VALIDATE_STACK(stk);
+
+	struct Stack_transaction *tx = &stk->transaction;
+	if (!tx->is_active) return STACK_FAILED;
+
+	for (size_t i = tx->low; i < tx->size; i++)
+		stk->data[i] = tx->undo[tx->size - 1 - i];
+
+	stk->size = tx->size;
+	end_transaction(stk);
+
+#ifdef HASH_PROTECTION
+	stk->data_hash = tx->data_hash;
+	update_header_hash(stk);
+#endif
+
+	if (validate_stack_op(stk, &err) == STACK_FAILED) {
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	return STACK_NO_ERR;
+}
+//-----------------------------
+
+bool is_valid_snapshot(struct Snapshot_header header, size_t file_size)
+{
+	uint64_t header_hash = header.header_hash;
+	header.header_hash = 0;
+	if (word_hash(&header, sizeof(header)) != header_hash)
+		return false;
+
+	if (file_size < SNAPSHOT_HEADER_SIZE + 2 * SNAPSHOT_CANARY_SIZE)
+		return false;
+	size_t data_size = file_size - SNAPSHOT_HEADER_SIZE - 2 * SNAPSHOT_CANARY_SIZE;
+
+	return memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+		   header.version == SNAPSHOT_VERSION && header.elem_size == sizeof(elem_t) &&
+		   header.size <= header.capacity && header.capacity > 0 &&
+		   header.capacity % SNAPSHOT_CAPACITY_ALIGN == 0 &&
+		   data_size % sizeof(elem_t) == 0 && data_size / sizeof(elem_t) == header.capacity;
+}
+
+bool read_header(FILE *file, struct Snapshot_header *header)
+{
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	return file_size >= 0 && fread(header, sizeof(*header), 1, file) == 1 &&
+		   is_valid_snapshot(*header, (size_t) file_size);
+}
+
+enum StackError read_snapshot_header(const char *path, struct Snapshot_header *header)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) return STACK_FAILED;
+
+	bool is_read = read_header(file, header);
+	fclose(file);
+
+	return is_read ? STACK_NO_ERR : STACK_FAILED;
+}
+
+enum StackError stack_save(struct Stack *stk, const char *path)
+{
+	VALIDATE_STACK(stk);
+
+	// slots above the size may still hold popped values
+	if (stk->transaction.is_active) return STACK_FAILED;
+
+	size_t capacity = (stk->capacity + SNAPSHOT_CAPACITY_ALIGN - 1) /
+					  SNAPSHOT_CAPACITY_ALIGN * SNAPSHOT_CAPACITY_ALIGN;
+	elem_t poison = {};
+	memset(&poison, POISON, sizeof(poison));
+
+	struct Snapshot_header header = {};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.elem_size = sizeof(elem_t);
+	header.size = stk->size;
+	header.capacity = capacity;
+	header.hash_kind = HASH_KIND;
+	header.data_hash = slots_hash(stk->data, sizeof(elem_t), 0, stk->capacity);
+	for (size_t i = stk->capacity; i < capacity; i++)
+		header.data_hash += slot_hash(&poison, sizeof(elem_t), i);
+	header.header_hash = word_hash(&header, sizeof(header));
+
+	FILE *file = fopen(path, "wb");
+	if (!file) return STACK_FAILED;
+
+	// the header padding and the left canary slot are left as a zero-filled hole
+	uint64_t canary_slot = 0;
+	bool is_written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+					  fseek(file, (long) (SNAPSHOT_HEADER_SIZE + SNAPSHOT_CANARY_SIZE),
+							SEEK_SET) == 0 &&
+					  fwrite(stk->data, sizeof(elem_t), stk->capacity, file) == stk->capacity;
+	for (size_t i = stk->capacity; is_written && i < capacity; i++)
+		is_written = fwrite(&poison, sizeof(poison), 1, file) == 1;
+	is_written = is_written && fwrite(&canary_slot, sizeof(canary_slot), 1, file) == 1;
+
+	// flushed to the disk, the journal relies on a saved snapshot being durable
+	is_written = is_written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+	if (fclose(file) != 0)
+		is_written = false;
+
+	return is_written ? STACK_NO_ERR : STACK_FAILED;
+}
+
+enum StackError stack_load(struct Stack *stk, print_func print_elem, const char *path,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) return STACK_FAILED;
+
+	struct Snapshot_header header = {};
+	if (!read_header(file, &header)) {
+		fclose(file);
+		return STACK_FAILED;
+	}
+
+	enum StackError error = stack_ctor(stk, print_elem, NULL, varname, line, filename,
+									   funcname);
+	if (error != STACK_NO_ERR) {
+		fclose(file);
+		return error;
+	}
+
+	error = stack_reserve(stk, header.capacity);
+	if (error != STACK_NO_ERR) {
+		fclose(file);
+		stack_dtor(stk);
+		return error;
+	}
+
+	bool is_read = fseek(file, (long) (SNAPSHOT_HEADER_SIZE + SNAPSHOT_CANARY_SIZE),
+						 SEEK_SET) == 0 &&
+				   fread(stk->data, sizeof(elem_t), header.size, file) == header.size;
+	fclose(file);
+
+	// slots past size are still poisoned, as they must be in the file
+	if (is_read && header.hash_kind == HASH_KIND)
+		is_read = slots_hash(stk->data, sizeof(elem_t), 0, header.capacity) == header.data_hash;
+	else if (is_read)
+		log_message(WARN, "Snapshot %s uses another hash, its data is not checked\n", path);
+
+	if (!is_read) {
+		memset(stk->data, POISON, header.size * sizeof(elem_t));
+		stack_dtor(stk);
+		return STACK_FAILED;
+	}
+
+	stk->size = header.size;
+	count_size(stk);
+	// the capacity came from the file, not from a reserve by the caller
+	stk->reserved = 0;
+	stk->shrink_limit = shrink_limit(&stk->policy, stk->capacity, stk->reserved);
 
 #ifdef HASH_PROTECTION
 	update_hash(stk);
 #endif
 
 	return STACK_NO_ERR;
-}
\ No newline at end of file
+}
+
+enum StackError stack_map(struct Stack *stk, print_func print_elem, struct File_map *map,
+						  const char *path, const char *varname, int line,
+						  const char *filename, const char *funcname)
+{
+	check_ctor(stk, print_elem);
+
+	enum StackError error = file_map_ctor(map, path);
+	if (error != STACK_NO_ERR) return error;
+
+	struct Snapshot_header header = {};
+	if (map->length < sizeof(header)) {
+		file_map_dtor(map);
+		return STACK_FAILED;
+	}
+
+	memcpy(&header, map->base, sizeof(header));
+	if (!is_valid_snapshot(header, map->length)) {
+		file_map_dtor(map);
+		return STACK_FAILED;
+	}
+
+	stk->size = header.size;
+	stk->capacity = header.capacity;
+	stk->allocator = &map->allocator;
+	stk->data = (elem_t*) (map->base + SNAPSHOT_HEADER_SIZE + SNAPSHOT_CANARY_SIZE);
+
+	init_header(stk, varname, line, filename, funcname);
+	count_size(stk);
+
+	// the saved data hash is trusted; full validation rechecks it
+#ifdef HASH_PROTECTION
+	if (header.hash_kind == HASH_KIND) {
+		stk->data_hash = header.data_hash;
+		update_header_hash(stk);
+	}
+	else
+		update_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
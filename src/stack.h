@@ -2,8 +2,16 @@
 #define STACK
 
 #include <limits.h>
+#include <stdint.h>
 
-#define STACK_CTOR(stk, print) stack_ctor((stk), (print), #stk, __LINE__, __FILE__, __func__)
+#define STACK_CTOR(stk, print) stack_ctor((stk), (print), NULL, #stk, __LINE__, __FILE__,	\
+												__func__)
+#define STACK_CTOR_ALLOC(stk, print, allocator) stack_ctor((stk), (print), (allocator), #stk,	\
+														   __LINE__, __FILE__, __func__)
+#define STACK_LOAD(stk, print, path) stack_load((stk), (print), (path), #stk, __LINE__,		\
+												__FILE__, __func__)
+#define STACK_MAP(stk, print, map, path) stack_map((stk), (print), (map), (path), #stk,		\
+												   __LINE__, __FILE__, __func__)
 
 struct Elem {
 	double cost;
@@ -16,6 +24,7 @@ const int POISON 			= 0xAE;
 const size_t INIT_CAPACITY 	= 2;
 const size_t MULTIPLIER 	= 2;
 const size_t SHRINK_COEF	= 4;
+const size_t DEFAULT_VALIDATION_PERIOD = 64;
 
 typedef int (*print_func)(char*, elem_t, size_t);
 
@@ -23,6 +32,106 @@ typedef int (*print_func)(char*, elem_t, size_t);
 typedef unsigned long long canary_t;
 #endif
 
+/*
+* Built with -DSTACK_INLINE_CAPACITY=N, the first N elements (and their data
+* canaries) live in the Stack itself and the allocator is only used once the
+* stack outgrows them; shrinking back to N moves the data inline again. A
+* stack holding inline data must not be copied or moved in memory.
+*/
+#ifdef STACK_INLINE_CAPACITY
+const size_t INLINE_CAPACITY = STACK_INLINE_CAPACITY;
+static_assert(INLINE_CAPACITY >= INIT_CAPACITY, "STACK_INLINE_CAPACITY is below INIT_CAPACITY");
+
+#ifdef CANARY_PROTECTION
+const size_t INLINE_BUFFER_SIZE = INLINE_CAPACITY * sizeof(elem_t) + 2 * sizeof(canary_t);
+#else
+const size_t INLINE_BUFFER_SIZE = INLINE_CAPACITY * sizeof(elem_t);
+#endif
+#endif
+
+struct Stack_allocator {
+	void *(*allocate)(void *ctx, size_t size);
+	void *(*reallocate)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+	void (*deallocate)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+enum ValidationLevel {
+	VALIDATE_HEADER		= 0,
+	VALIDATE_PERIODIC	= 1,
+	VALIDATE_FULL		= 2
+};
+
+enum Growth_policy {
+	GROW_GEOMETRIC	= 0,
+	GROW_INCREMENT	= 1
+};
+
+enum Shrink_policy {
+	SHRINK_STEP		= 0,
+	SHRINK_NEVER	= 1,
+	SHRINK_DELAYED	= 2
+};
+
+/*
+* How a stack resizes. Growing multiplies the capacity by factor or adds
+* increment. A pop shrinks one growth step back only while the smaller
+* capacity would still fit one more growth step of elements, so pushes and pops
+* around a boundary don't reallocate every time. SHRINK_DELAYED waits until
+* that has held for shrink_delay operations in a row.
+*/
+struct Stack_policy {
+	double factor;
+	size_t increment;
+	size_t shrink_delay;
+	enum Growth_policy growth;
+	enum Shrink_policy shrink;
+};
+
+const double MAX_GROWTH_FACTOR = 16;
+const struct Stack_policy DEFAULT_POLICY = { (double) MULTIPLIER, 0, 0, GROW_GEOMETRIC, SHRINK_STEP };
+
+/*
+* State of an open stack_begin transaction. Slots from low up to the size at
+* stack_begin were popped inside it; their old values are kept in undo, top
+* first, so that pushes may overwrite them. Slots from the current size up to
+* high may still hold popped values: they are poisoned at commit or rollback.
+* data_hash is the data hash at stack_begin, plus the poisoned slots of any
+* growth since. The undo buffer is kept between transactions.
+*/
+struct Stack_transaction {
+	bool is_active;
+	size_t size;
+	size_t low;
+	size_t high;
+
+#ifdef HASH_PROTECTION
+	unsigned long data_hash;
+#endif
+
+	elem_t *undo;
+	size_t undo_capacity;
+};
+
+enum Stack_stat {
+	STAT_PUSHES				= 0,
+	STAT_POPS				= 1,
+	STAT_GROWS				= 2,
+	STAT_SHRINKS			= 3,
+	STAT_BYTES_MOVED		= 4,
+	STAT_VALIDATIONS		= 5,
+	STAT_VALIDATION_CYCLES	= 6,
+	STAT_HASH_UPDATES		= 7,
+	STAT_HASH_CYCLES		= 8,
+	STAT_PEAK_SIZE			= 9,
+	NUM_STATS				= 10
+};
+
+// cycle counts are sampled and scaled, so they are estimates
+struct Stack_stats {
+	size_t counters[NUM_STATS];
+};
+
 struct Stack {
 #ifdef CANARY_PROTECTION
 	canary_t left_canary;
@@ -36,17 +145,75 @@ struct Stack {
 	size_t capacity;
 	size_t size;
 	elem_t *data;
+	const struct Stack_allocator *allocator;
+	// NULL unless the stack was opened with STACK_OPEN
+	struct Journal *journal;
 	const char *varname;
 	const char *filename;
 	const char *funcname;
 	int line;
 
+	enum ValidationLevel validation;
+	size_t validation_period;
+
+	struct Stack_policy policy;
+	// sizes below this can shrink the current capacity
+	size_t shrink_limit;
+	// capacity asked for by stack_reserve, kept until stack_shrink_to_fit
+	size_t reserved;
+	// operations in a row the stack could have shrunk, for SHRINK_DELAYED
+	size_t oversized_ops;
+
+	struct Stack_transaction transaction;
+
+	// from here to the end of stats is not covered by the header hash, so
+	// counting operations never has to rehash
+	size_t ops_since_check;
+	struct Stack_stats stats;
+
+#ifdef STACK_INLINE_CAPACITY
+	// skipped by the header hash too: the data hash covers it while in use
+	alignas(elem_t) unsigned char inline_buffer[INLINE_BUFFER_SIZE];
+#endif
+
 #ifdef CANARY_PROTECTION
 	canary_t right_canary;
 #endif
 };
 
+/*
+* Snapshot file: this header padded to SNAPSHOT_HEADER_SIZE, a canary slot,
+* capacity raw elements (unused ones poisoned) and another canary slot, so the
+* file can be mapped as a stack buffer with or without CANARY_PROTECTION.
+* Fields are in native byte order. header_hash is word_hash of the header with
+* header_hash = 0; data_hash is the stack data hash in the saver's hash_kind.
+*/
+const char SNAPSHOT_MAGIC[8]			= "STKSNAP";
+const uint32_t SNAPSHOT_VERSION			= 1;
+const size_t SNAPSHOT_HEADER_SIZE		= 4096;
+const size_t SNAPSHOT_CANARY_SIZE		= 8;
+// matches round_capacity under CANARY_PROTECTION, so any snapshot can be mapped
+const size_t SNAPSHOT_CAPACITY_ALIGN	= 8;
+
+struct Snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t elem_size;
+	uint64_t size;
+	uint64_t capacity;
+	uint64_t data_hash;
+	uint64_t header_hash;
+	uint32_t hash_kind;
+	uint32_t reserved;
+};
+
+/*
+* ERR_NOT_DURABLE comes from operations on a journaled stack: the change is
+* made in memory, but its journal record could not be written or synced.
+*/
 enum StackError {
+	ERR_NOT_DURABLE	= -5,
+	ERR_STEAL_LOST	= -4,
 	ERR_STACK_EMPTY = -3,
 	STACK_FAILED 	= -2,
 	ERR_NO_MEM 		= -1,
@@ -54,10 +221,51 @@ enum StackError {
 };
 
 enum StackError stack_ctor(struct Stack *stk, print_func print_elem,
+						   const struct Stack_allocator *allocator,
 						   const char *varname, int line, const char *filename,
 						   const char *funcname);
 enum StackError stack_dtor(struct Stack *stk);
 enum StackError stack_push(struct Stack *stk, elem_t value);
 enum StackError stack_pop(struct Stack *stk, elem_t *value);
+enum StackError stack_reserve(struct Stack *stk, size_t capacity);
+enum StackError stack_push_n(struct Stack *stk, const elem_t *values, size_t n);
+// values[n - 1] receives the old top, so push_n(a) followed by pop_n restores a;
+// values may be NULL to drop the elements
+enum StackError stack_pop_n(struct Stack *stk, elem_t *values, size_t n);
+// moves a stack to zero-filled dst without touching its buffer; src is left zero-filled
+enum StackError stack_move(struct Stack *dst, struct Stack *src);
+// reallocates to the smallest capacity that holds the elements
+enum StackError stack_shrink_to_fit(struct Stack *stk);
+enum StackError stack_set_policy(struct Stack *stk, struct Stack_policy policy);
+
+/*
+* Between stack_begin and stack_commit, push and pop skip validation, hashing,
+* shrinking and the journal. stack_commit hashes the slots the transaction
+* touched, validates once at the stack's level and journals the net change.
+* stack_rollback restores the size, elements and data hash of stack_begin
+* without rehashing: it only poisons the slots the transaction used and copies
+* back the elements it popped below its starting size.
+* Transactions don't nest, and stack_save, stack_shrink_to_fit and the setters
+* return STACK_FAILED inside one. stack_dtor rolls back an open transaction.
+*/
+enum StackError stack_begin(struct Stack *stk);
+enum StackError stack_commit(struct Stack *stk);
+enum StackError stack_rollback(struct Stack *stk);
+void stack_set_default_allocator(const struct Stack_allocator *allocator);
+enum StackError stack_set_validation(struct Stack *stk, enum ValidationLevel level,
+									 size_t period);
+// counters of one stack, or totals over all stacks and threads for NULL
+struct Stack_stats stack_stats(const struct Stack *stk);
+
+enum StackError stack_save(struct Stack *stk, const char *path);
+enum StackError read_snapshot_header(const char *path, struct Snapshot_header *header);
+// reads a snapshot into a new heap stack in one pass, checking the data hash
+enum StackError stack_load(struct Stack *stk, print_func print_elem, const char *path,
+						   const char *varname, int line, const char *filename,
+						   const char *funcname);
+// makes the snapshot itself the buffer of a new stack, in constant time
+enum StackError stack_map(struct Stack *stk, print_func print_elem, struct File_map *map,
+						  const char *path, const char *varname, int line,
+						  const char *filename, const char *funcname);
 
 #endif
\ No newline at end of file
@@ -1,40 +1,75 @@
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "logger.h"
 #include "stack.h"
 #include "stack_debug.h"
 #include "colors.h"
+#include "allocators.h"
+#include "poison_scan.h"
 
 #ifdef HASH_PROTECTION
-unsigned long gnu_hash(void *data_ptr, size_t size);
+unsigned long compute_data_hash(struct Stack *stk);
 #endif
 
+#ifdef GUARD_PROTECTION
+void guard_fault_handler(int sig, siginfo_t *info, void *context);
+void write_string(const char *string);
+void write_number(uintmax_t value, unsigned base);
+
+std::atomic<struct Stack*> GUARD_STACKS[GUARD_MAX_STACKS];
+struct sigaction OLD_SEGV_ACTION = {};
+#endif
+
+enum StackError check_stack_op(struct Stack *stk, int *err);
+unsigned long header_hash(struct Stack *stk);
+
+std::atomic<struct Stats_block*> ALL_STATS(NULL);
+__thread struct Stats_block *THREAD_STATS = NULL;
+
+const char *STACK_STAT_NAMES[] = {
+	"pushes",
+	"pops",
+	"grows",
+	"shrinks",
+	"bytes moved",
+	"validations",
+	"validation cycles",
+	"hash updates",
+	"hash cycles",
+	"peak size",
+};
+
 print_func PRINT_ELEM = NULL;
 
 const char *STACK_FAILURE_MSG[] = {
 	"Stack pointer is NULL!\n",
-	"Stack capacity is less then initial!\n",
+	"Stack size is greater then capacity!\n",
 	"Data pointer in a stack is NULL!\n",
 	"A poison value is in stack!\n",
 	"A non-poison value is in stack's unused memory!\n",
-	"Stack size is greater then capacity!\n",
+	"Stack capacity is less then initial!\n",
 	"A constructor was called twice!\n",
-
-#ifdef CANARY_PROTECTION
 	"Stack's left canary is bad!\n",
 	"Stack's right canary is bad!\n",
-	"Stack's data left canary is bad!\n",
 	"Stack's data right canary is bad!\n",
-#endif
-
-#ifdef HASH_PROTECTION
+	"Stack's data left canary is bad!\n",
 	"Stack's hash doesn't match!\n",
 	"Stack's data hash doesn't match!\n",
-#endif
+	"Out-of-bounds access hit a guard page!\n",
 };
 
-enum StackError validate_stack(struct Stack *stk, int *err)
+enum StackError validate_stack_header(struct Stack *stk, int *err)
 {
 	*err = 0;
 
@@ -52,7 +87,6 @@ enum StackError validate_stack(struct Stack *stk, int *err)
 	if (stk->capacity < INIT_CAPACITY)
 		*err |= 1 << SMALL_CAPACITY;
 
-
 #ifdef CANARY_PROTECTION
 	if (stk->data && ((canary_t*) stk->data)[-1] != DEFAULT_CANARY)
 		*err |= 1 << LEFT_DATA_CANARY_BAD;
@@ -63,7 +97,7 @@ enum StackError validate_stack(struct Stack *stk, int *err)
 	unsigned long old_data_hash = stk->data_hash;
 	stk->hash = 0;
 	stk->data_hash = 0;
-	if (old_hash != gnu_hash(stk, sizeof(Stack)))
+	if (old_hash != header_hash(stk))
 		*err |= 1 << WRONG_HASH;
 	stk->hash = old_hash;
 	stk->data_hash = old_data_hash;
@@ -84,30 +118,48 @@ enum StackError validate_stack(struct Stack *stk, int *err)
 	if (*err & 1 << WRONG_HASH) {
 		return STACK_FAILED;
 	}
-	stk->hash = 0;
-	stk->data_hash = 0;
-	if (old_data_hash != gnu_hash(stk->data, stk->capacity))
-		*err |= 1 << WRONG_DATA_HASH;
-	stk->hash = old_hash;
-	stk->data_hash = old_data_hash;
 #endif
 
-#ifdef STACK_PROTECTION
-	if (stk->data && *((canary_t*) (stk->data + stk->capacity)) != DEFAULT_CANARY)
+	if (*err != 0)
+		return STACK_FAILED;
+
+#ifdef CANARY_PROTECTION
+	if (*((canary_t*) (stk->data + stk->capacity)) != DEFAULT_CANARY)
 		*err |= 1 << RIGHT_DATA_CANARY_BAD;
 #endif
 
-	if (stk->data) {
-		unsigned char tester[sizeof(elem_t)] = {};
-		memset(tester, POISON, sizeof(elem_t));
+	if (stk->size > 0 && is_poisoned(stk->data + stk->size - 1, sizeof(elem_t)))
+		*err |= 1 << POISONED_VALUE;
 
-		for (size_t i = 0; i < stk->size; i++)
-			if (memcmp(stk->data + i, tester, sizeof(elem_t)) == 0)
-				*err |= 1 << POISONED_VALUE;
+	if (stk->size < stk->capacity && !is_poisoned(stk->data + stk->size, sizeof(elem_t)))
+		*err |= 1 << UNPOISONED_VALUE;
 
-		for (size_t i = stk->size; i < stk->capacity; i++)
-			if (memcmp(stk->data + i, tester, sizeof(elem_t)) != 0)
-				*err |= 1 << UNPOISONED_VALUE;
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+enum StackError validate_stack(struct Stack *stk, int *err)
+{
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+#ifdef HASH_PROTECTION
+	if (stk->data_hash != compute_data_hash(stk))
+		*err |= 1 << WRONG_DATA_HASH;
+#endif
+
+	size_t poisoned = find_poisoned(stk->data, stk->size, sizeof(elem_t));
+	if (poisoned < stk->size) {
+		*err |= 1 << POISONED_VALUE;
+		log_message(DEBUG, "First poisoned element is [%lu]\n", poisoned);
+	}
+
+	size_t unpoisoned = stk->size + find_unpoisoned(stk->data + stk->size,
+													stk->capacity - stk->size, sizeof(elem_t));
+	if (unpoisoned < stk->capacity) {
+		*err |= 1 << UNPOISONED_VALUE;
+		log_message(DEBUG, "First non-poison unused element is [%lu]\n", unpoisoned);
 	}
 
 	if (*err != 0)
@@ -115,8 +167,58 @@ enum StackError validate_stack(struct Stack *stk, int *err)
 	return STACK_NO_ERR;
 }
 
+// hashes are stale inside a transaction, stack_commit validates instead
+enum StackError validate_stack_op(struct Stack *stk, int *err)
+{
+	if (!stk) return check_stack_op(stk, err);
+	if (stk->transaction.is_active) {
+		*err = 0;
+		return STACK_NO_ERR;
+	}
+
+	bool is_sampled = stk->stats.counters[STAT_VALIDATIONS] % STATS_SAMPLE_PERIOD == 0;
+	unsigned long long start = is_sampled ? read_cycles() : 0;
+
+	enum StackError result = check_stack_op(stk, err);
+
+	count_stat(stk, STAT_VALIDATIONS, 1);
+	if (is_sampled)
+		count_stat(stk, STAT_VALIDATION_CYCLES,
+				   (size_t) (read_cycles() - start) * STATS_SAMPLE_PERIOD);
+
+	return result;
+}
+
+enum StackError check_stack_op(struct Stack *stk, int *err)
+{
+	if (!stk || stk->validation == VALIDATE_FULL)
+		return validate_stack(stk, err);
+
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+	switch (stk->validation) {
+		case VALIDATE_HEADER:
+			return STACK_NO_ERR;
+		case VALIDATE_PERIODIC:
+			break;
+		case VALIDATE_FULL:
+		default:
+			return validate_stack(stk, err);
+	}
+
+	bool full_check = ++stk->ops_since_check >= stk->validation_period;
+	if (!full_check)
+		return STACK_NO_ERR;
+
+	stk->ops_since_check = 0;
+	return validate_stack(stk, err);
+}
+
 void stack_dump(struct Stack *stk)
 {
+	if (!LOG_ENABLED(DEBUG)) return;
+
 	const int POISONED_MAX = 20;
 	log_message(DEBUG, "Stack [%p]\n", stk);
 
@@ -128,6 +230,15 @@ void stack_dump(struct Stack *stk)
 			   "\t\tcapacity = %lu\n",
 			   stk->size, stk->capacity);
 
+	if (stk->transaction.is_active)
+		log_string(DEBUG, "\t\ttransaction from size %lu, hashes not updated\n",
+				   stk->transaction.size);
+
+	log_string(DEBUG, "\t\tstats\n\t\t{\n");
+	for (size_t i = 0; i < NUM_STATS; i++)
+		log_string(DEBUG, "\t\t\t%s = %lu\n", STACK_STAT_NAMES[i], stk->stats.counters[i]);
+	log_string(DEBUG, "\t\t}\n");
+
 #ifdef CANARY_PROTECTION
 	if (stk->left_canary == DEFAULT_CANARY)
 		log_string(DEBUG, "%s\t\tleft canary = 0x%llX\n%s",
@@ -152,7 +263,7 @@ void stack_dump(struct Stack *stk)
 	unsigned long old_data_hash = stk->data_hash;
 	stk->hash = 0;
 	stk->data_hash = 0;
-	unsigned long new_hash = gnu_hash(stk, sizeof(Stack));
+	unsigned long new_hash = header_hash(stk);
 
 	if (old_hash == new_hash)
 		log_string(DEBUG, "%s\t\thash = 0x%lX\n%s",
@@ -163,8 +274,11 @@ void stack_dump(struct Stack *stk)
    log_string(DEBUG, "%s\t\tactual hash = 0x%lX\n%s",
 		      BLUE, new_hash, RESET_COLOR);
 
-	if (old_hash == new_hash) {
-		unsigned long new_data_hash = gnu_hash(stk->data, stk->capacity);
+	stk->hash = old_hash;
+	stk->data_hash = old_data_hash;
+
+	if (old_hash == new_hash && stk->data) {
+		unsigned long new_data_hash = compute_data_hash(stk);
 
 		if (old_data_hash == new_data_hash)
 			log_string(DEBUG, "%s\t\tdata hash = 0x%lX\n%s",
@@ -175,12 +289,16 @@ void stack_dump(struct Stack *stk)
 		log_string(DEBUG, "%s\t\tactual data hash = 0x%lX\n%s",
 				   BLUE, new_data_hash, RESET_COLOR);
 	}
-
-	stk->hash = old_hash;
-	stk->data_hash = old_data_hash;
 #endif
 
+#ifdef STACK_INLINE_CAPACITY
+	if (is_inline_data(stk))
+		log_string(DEBUG, "\t\tdata [%p] (inline)\n", stk->data);
+	else
+		log_string(DEBUG, "\t\tdata [%p]\n", stk->data);
+#else
 	log_string(DEBUG, "\t\tdata [%p]\n", stk->data);
+#endif
 
 	if (!stk->data) {
 		log_string(DEBUG, "\t}\n");
@@ -212,14 +330,12 @@ void stack_dump(struct Stack *stk)
 
 	const size_t BUFF_SIZE = 1024;
 	char buffer[BUFF_SIZE] = {};
-	unsigned char tester[sizeof(elem_t)] = {};
-	memset(tester, POISON, sizeof(elem_t));
 	size_t i = 0;
 	for (; i < stk->size && i < stk->capacity; i++) {
 		PRINT_ELEM(buffer, stk->data[i], BUFF_SIZE);
 		log_string(DEBUG, "\t\t\t*[%lu] = ", i);
 		log_string(DEBUG, "%s", buffer);
-		if (memcmp(stk->data + i, tester, sizeof(elem_t)) == 0)
+		if (is_poisoned(stk->data + i, sizeof(elem_t)))
 			log_string(DEBUG, " (poison)");
 		log_string(DEBUG, "\n");
 	}
@@ -227,7 +343,7 @@ void stack_dump(struct Stack *stk)
 		PRINT_ELEM(buffer, stk->data[i], BUFF_SIZE);
 		log_string(DEBUG, "\t\t\t[%lu] = ", i);
 		log_string(DEBUG, "%s", buffer);
-		if (memcmp(stk->data + i, tester, sizeof(elem_t)) == 0)
+		if (is_poisoned(stk->data + i, sizeof(elem_t)))
 			log_string(DEBUG, " (poison)");
 		log_string(DEBUG, "\n");
 	}
@@ -244,8 +360,7 @@ void stack_dump(struct Stack *stk)
 	log_string(DEBUG, "\t\t}\n\t}\n");
 }
 
-void stack_report_fail(struct Stack *stk, int err,
-					   const char *filename, int line, const char *func_name)
+void log_stack_failures(int err, const char *filename, int line, const char *func_name)
 {
 	size_t stack_failure_num = sizeof(STACK_FAILURE_MSG) / sizeof(STACK_FAILURE_MSG[0]);
 	for (size_t i = 0; i < stack_failure_num; i++)
@@ -254,27 +369,229 @@ void stack_report_fail(struct Stack *stk, int err,
 
 	log_message(DEBUG, "stack_dump called from %s (%d) %s()\n",
 				filename, line, func_name);
+}
 
+void stack_report_fail(struct Stack *stk, int err,
+					   const char *filename, int line, const char *func_name)
+{
+	log_stack_failures(err, filename, line, func_name);
 	stack_dump(stk);
+	logger_flush();
+}
+
+unsigned long long read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000 + (unsigned long long) ts.tv_nsec;
+#endif
+}
+
+struct Stats_block *thread_stats()
+{
+	if (THREAD_STATS != NULL)
+		return THREAD_STATS;
+
+	THREAD_STATS = (struct Stats_block*) calloc(1, sizeof(Stats_block));
+	if (THREAD_STATS == NULL)
+		return NULL;
+
+	struct Stats_block *head = ALL_STATS.load(std::memory_order_relaxed);
+	do {
+		THREAD_STATS->next = head;
+	} while (!ALL_STATS.compare_exchange_weak(head, THREAD_STATS, std::memory_order_release,
+											  std::memory_order_relaxed));
+
+	return THREAD_STATS;
+}
+
+struct Stack_stats stack_stats(const struct Stack *stk)
+{
+	if (stk != NULL)
+		return stk->stats;
+
+	struct Stack_stats total = {};
+	for (struct Stats_block *block = ALL_STATS.load(std::memory_order_acquire);
+		 block != NULL; block = block->next) {
+		for (size_t i = 0; i < NUM_STATS; i++) {
+			size_t value = block->counters[i].load(std::memory_order_relaxed);
+			if (i == STAT_PEAK_SIZE)
+				total.counters[i] = value > total.counters[i] ? value : total.counters[i];
+			else
+				total.counters[i] += value;
+		}
+	}
+
+	return total;
+}
+
+#ifdef GUARD_PROTECTION
+/*
+* Stacks whose buffers come from GUARD_ALLOCATOR are kept in a fixed table,
+* so the SIGSEGV handler can find the owner of a faulting address without
+* allocating. Faults outside all guard pages go to the previous handler.
+*/
+void guard_register(struct Stack *stk)
+{
+	static std::atomic<bool> is_installed(false);
+	if (!is_installed.exchange(true)) {
+		struct sigaction action = {};
+		action.sa_sigaction = guard_fault_handler;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, &OLD_SEGV_ACTION);
+	}
+
+	for (size_t i = 0; i < GUARD_MAX_STACKS; i++) {
+		struct Stack *expected = NULL;
+		if (GUARD_STACKS[i].compare_exchange_strong(expected, stk))
+			return;
+	}
+
+	log_message(WARN, "Guard table is full, faults in [%p] will not be reported\n", stk);
+}
+
+void guard_unregister(struct Stack *stk)
+{
+	for (size_t i = 0; i < GUARD_MAX_STACKS; i++) {
+		struct Stack *expected = stk;
+		if (GUARD_STACKS[i].compare_exchange_strong(expected, NULL))
+			return;
+	}
+}
+
+// write(2) only: the logger and stdio aren't async-signal-safe
+void write_string(const char *string)
+{
+	if (string != NULL)
+		(void) !write(STDERR_FILENO, string, strlen(string));
+}
+
+void write_number(uintmax_t value, unsigned base)
+{
+	char digits[sizeof(uintmax_t) * 8 + 1] = {};
+	size_t pos = sizeof(digits) - 1;
+	do {
+		digits[--pos] = "0123456789ABCDEF"[value % base];
+		value /= base;
+	} while (value != 0);
+
+	write_string(digits + pos);
+}
+
+// a full dump needs the logger, so it is left to the core file abort() leaves
+void guard_fault_handler(int sig, siginfo_t *info, void *context)
+{
+	(void) sig;
+	(void) context;
+
+#ifdef CANARY_PROTECTION
+	const size_t canary_size = sizeof(canary_t);
+#else
+	const size_t canary_size = 0;
+#endif
+
+	for (size_t i = 0; i < GUARD_MAX_STACKS; i++) {
+		struct Stack *stk = GUARD_STACKS[i].load(std::memory_order_relaxed);
+		if (stk == NULL || stk->data == NULL)
+			continue;
+
+#ifdef STACK_INLINE_CAPACITY
+		if (is_inline_data(stk))
+			continue;
+#endif
+
+		const unsigned char *buffer = (const unsigned char*) stk->data - canary_size;
+		size_t size = stk->capacity * sizeof(elem_t) + 2 * canary_size;
+		if (is_guard_page(buffer, size, info->si_addr)) {
+			write_string(STACK_FAILURE_MSG[GUARD_PAGE_HIT]);
+			write_string("Fault at [0x");
+			write_number((uintptr_t) info->si_addr, 16);
+			write_string("] in stack [0x");
+			write_number((uintptr_t) stk, 16);
+			write_string("] \"");
+			write_string(stk->varname);
+			write_string("\" from ");
+			write_string(stk->filename);
+			write_string(" (");
+			write_number((uintmax_t) stk->line, 10);
+			write_string(")\n");
+			abort();
+		}
+	}
+
+	sigaction(SIGSEGV, &OLD_SEGV_ACTION, NULL);
 }
+#endif
 
 #ifdef HASH_PROTECTION
-unsigned long gnu_hash(void *data_ptr, size_t size)
+unsigned long range_hash(struct Stack *stk, size_t from, size_t to)
 {
-	unsigned char *data = (unsigned char*) data_ptr;
-	unsigned long hash = 5381;
+	return slots_hash(stk->data, sizeof(elem_t), from, to);
+}
+
+unsigned long compute_data_hash(struct Stack *stk)
+{
+	return range_hash(stk, 0, stk->capacity);
+}
 
-	for (size_t i = 0; i < size; i++)
-		hash = ((hash << 5) + hash) + (long unsigned int) data[i];
+// the stats block and inline data are skipped, they change on every operation
+unsigned long header_hash(struct Stack *stk)
+{
+	const unsigned char *header = (const unsigned char*) stk;
+	size_t skip_from = offsetof(struct Stack, ops_since_check);
+#ifdef STACK_INLINE_CAPACITY
+	size_t skip_to = offsetof(struct Stack, inline_buffer) + sizeof(stk->inline_buffer);
+#else
+	size_t skip_to = offsetof(struct Stack, stats) + sizeof(stk->stats);
+#endif
 
-	return hash;
+	return hash_bytes(header, skip_from) ^
+		   hash_bytes(header + skip_to, sizeof(Stack) - skip_to) * 0x9E3779B97F4A7C15UL;
 }
 
-void update_hash(struct Stack *stk)
+void update_header_hash(struct Stack *stk)
 {
+	bool is_sampled = stk->stats.counters[STAT_HASH_UPDATES] % STATS_SAMPLE_PERIOD == 0;
+	unsigned long long start = is_sampled ? read_cycles() : 0;
+
+	unsigned long data_hash = stk->data_hash;
 	stk->hash = 0;
 	stk->data_hash = 0;
-	stk->hash = gnu_hash(stk, sizeof(Stack));
-	stk->data_hash = gnu_hash(stk->data, stk->capacity);
+	stk->hash = header_hash(stk);
+	stk->data_hash = data_hash;
+
+	count_stat(stk, STAT_HASH_UPDATES, 1);
+	if (is_sampled)
+		count_stat(stk, STAT_HASH_CYCLES, (size_t) (read_cycles() - start) * STATS_SAMPLE_PERIOD);
+}
+
+void update_slot_hash(struct Stack *stk, size_t index, unsigned long old_slot_hash)
+{
+	stk->data_hash += slot_hash(stk->data + index, sizeof(elem_t), index) - old_slot_hash;
+	update_header_hash(stk);
+}
+
+// range and full rehashes are O(n), so they are always timed
+void update_range_hash(struct Stack *stk, size_t from, size_t to,
+					   unsigned long old_range_hash)
+{
+	unsigned long long start = read_cycles();
+	stk->data_hash += range_hash(stk, from, to) - old_range_hash;
+	count_stat(stk, STAT_HASH_CYCLES, (size_t) (read_cycles() - start));
+
+	update_header_hash(stk);
 }
-#endif
\ No newline at end of file
+
+void update_hash(struct Stack *stk)
+{
+	unsigned long long start = read_cycles();
+	stk->data_hash = compute_data_hash(stk);
+	count_stat(stk, STAT_HASH_CYCLES, (size_t) (read_cycles() - start));
+
+	update_header_hash(stk);
+}
+#endif
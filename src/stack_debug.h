@@ -1,21 +1,49 @@
 #ifndef STACK_DEBUG
 #define STACK_DEBUG
 
+#include <atomic>
+
 #include "stack.h"
+#include "hash.h"
 
 #define STACK_REPORT_FAIL(stk, err) stack_report_fail((stk), (err), __FILE__,	\
 													  __LINE__, __func__)
 
 #define VALIDATE_STACK(stk) int err = 0;										\
-							if (validate_stack(stk, &err) == STACK_FAILED) {	\
+							if (validate_stack_op(stk, &err) == STACK_FAILED) {	\
 								STACK_REPORT_FAIL((stk), err);					\
 								abort();										\
 							}
 
+#define VALIDATE_STACK_FULL(stk) int err = 0;									\
+								 if (validate_stack(stk, &err) == STACK_FAILED) {\
+									 STACK_REPORT_FAIL((stk), err);				\
+									 abort();									\
+								 }
+
 #ifdef CANARY_PROTECTION
 const canary_t DEFAULT_CANARY = 0xDECAFBAD;
 #endif
 
+#ifdef GUARD_PROTECTION
+const size_t GUARD_MAX_STACKS = 1024;
+#endif
+
+const size_t STATS_SAMPLE_PERIOD = 64;
+
+/*
+* Global counters are kept per thread, so counting is a relaxed load and store
+* on a line no other thread writes. Blocks are never freed: counts of finished
+* threads stay in the totals.
+*/
+struct Stats_block {
+	std::atomic<size_t> counters[NUM_STATS];
+	struct Stats_block *next;
+};
+
+// __thread rather than thread_local: no TLS wrapper call on every access
+extern __thread struct Stats_block *THREAD_STATS;
+
 extern print_func PRINT_ELEM;
 
 enum StackFailure {
@@ -38,15 +66,75 @@ enum StackFailure {
 	WRONG_HASH			  = 11,
 	WRONG_DATA_HASH		  = 12,
 #endif
+
+#ifdef GUARD_PROTECTION
+	GUARD_PAGE_HIT		  = 13,
+#endif
 };
 
 enum StackError validate_stack(struct Stack *stk, int *err);
+enum StackError validate_stack_header(struct Stack *stk, int *err);
+enum StackError validate_stack_op(struct Stack *stk, int *err);
 void stack_dump(struct Stack *stk);
+void log_stack_failures(int err, const char *filename, int line, const char *func_name);
 void stack_report_fail(struct Stack *stk, int err,
 					   const char *filename, int line, const char *func_name);
+void default_validation(enum ValidationLevel *level, size_t *period);
+struct Stats_block *thread_stats();
+unsigned long long read_cycles();
+
+#ifdef GUARD_PROTECTION
+void guard_register(struct Stack *stk);
+void guard_unregister(struct Stack *stk);
+#endif
+
+#ifdef STACK_INLINE_CAPACITY
+inline elem_t *inline_data(struct Stack *stk)
+{
+#ifdef CANARY_PROTECTION
+	return (elem_t*) (stk->inline_buffer + sizeof(canary_t));
+#else
+	return (elem_t*) stk->inline_buffer;
+#endif
+}
+
+inline bool is_inline_data(struct Stack *stk)
+{
+	return stk->data == inline_data(stk);
+}
+#endif
+
+// inline: these run on every operation
+inline void count_stat(struct Stack *stk, enum Stack_stat stat, size_t n)
+{
+	stk->stats.counters[stat] += n;
+
+	struct Stats_block *block = THREAD_STATS ? THREAD_STATS : thread_stats();
+	if (block != NULL)
+		block->counters[stat].store(block->counters[stat].load(std::memory_order_relaxed) + n,
+									std::memory_order_relaxed);
+}
+
+inline void count_size(struct Stack *stk)
+{
+	if (stk->size <= stk->stats.counters[STAT_PEAK_SIZE])
+		return;
+
+	stk->stats.counters[STAT_PEAK_SIZE] = stk->size;
+
+	struct Stats_block *block = THREAD_STATS ? THREAD_STATS : thread_stats();
+	if (block != NULL && block->counters[STAT_PEAK_SIZE].load(std::memory_order_relaxed) <
+						 stk->size)
+		block->counters[STAT_PEAK_SIZE].store(stk->size, std::memory_order_relaxed);
+}
 
 #ifdef HASH_PROTECTION
 void update_hash(struct Stack *stk);
+void update_header_hash(struct Stack *stk);
+void update_slot_hash(struct Stack *stk, size_t index, unsigned long old_slot_hash);
+unsigned long range_hash(struct Stack *stk, size_t from, size_t to);
+void update_range_hash(struct Stack *stk, size_t from, size_t to,
+					   unsigned long old_range_hash);
 #endif
 
 #endif
\ No newline at end of file
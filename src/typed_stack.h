@@ -0,0 +1,577 @@
+#ifndef TYPED_STACK
+#define TYPED_STACK
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "logger.h"
+#include "stack.h"
+#include "stack_debug.h"
+#include "poison_scan.h"
+
+#define TYPED_STACK_CTOR(stk) stack_ctor((stk), #stk, __LINE__, __FILE__, __func__)
+
+inline int print_bytes(char *buffer, const void *value, size_t size, size_t n)
+{
+	const unsigned char *bytes = (const unsigned char*) value;
+	int written = 0;
+	for (size_t i = 0; i < size && (size_t) written < n; i++)
+		written += snprintf(buffer + written, n - (size_t) written, "%02X", bytes[i]);
+
+	return written;
+}
+
+template <typename T>
+struct Elem_traits {
+	static int print(char *buffer, const T &value, size_t n)
+	{
+		return print_bytes(buffer, &value, sizeof(T), n);
+	}
+};
+
+template <>
+struct Elem_traits<int> {
+	static int print(char *buffer, int value, size_t n)
+	{
+		return snprintf(buffer, n, "%d", value);
+	}
+};
+
+template <>
+struct Elem_traits<long> {
+	static int print(char *buffer, long value, size_t n)
+	{
+		return snprintf(buffer, n, "%ld", value);
+	}
+};
+
+template <>
+struct Elem_traits<double> {
+	static int print(char *buffer, double value, size_t n)
+	{
+		return snprintf(buffer, n, "%lf", value);
+	}
+};
+
+template <>
+struct Elem_traits<struct Elem> {
+	static int print(char *buffer, const struct Elem &value, size_t n)
+	{
+		return snprintf(buffer, n, "cost: %.2lf; amount: %d", value.cost, value.amount);
+	}
+};
+
+template <typename T>
+struct Elem_traits<T*> {
+	static int print(char *buffer, const T *value, size_t n)
+	{
+		return snprintf(buffer, n, "%p", (const void*) value);
+	}
+};
+
+template <typename T, typename Traits = Elem_traits<T>>
+struct TypedStack {
+#ifdef CANARY_PROTECTION
+	canary_t left_canary;
+#endif
+
+#ifdef HASH_PROTECTION
+	unsigned long hash;
+	unsigned long data_hash;
+#endif
+
+	size_t capacity;
+	size_t size;
+	T *data;
+	const char *varname;
+	const char *filename;
+	const char *funcname;
+	int line;
+
+	enum ValidationLevel validation;
+	size_t validation_period;
+	// not covered by the header hash, so counting operations never has to rehash
+	size_t ops_since_check;
+
+#ifdef CANARY_PROTECTION
+	canary_t right_canary;
+#endif
+};
+
+template <typename T>
+struct Typed_layout {
+	// buffers come from calloc/realloc, which align no further than max_align_t
+	static_assert(alignof(T) <= alignof(max_align_t),
+				  "TypedStack elements can't be over-aligned");
+
+#ifdef CANARY_PROTECTION
+	static const size_t DATA_OFFSET = alignof(T) > sizeof(canary_t) ?
+									  alignof(T) : sizeof(canary_t);
+	static const size_t CANARIES_SIZE = DATA_OFFSET + sizeof(canary_t);
+
+	static size_t round_capacity(size_t capacity)
+	{
+		while (capacity * sizeof(T) % sizeof(canary_t) != 0)
+			capacity++;
+		return capacity;
+	}
+#else
+	static const size_t DATA_OFFSET = 0;
+	static const size_t CANARIES_SIZE = 0;
+
+	static size_t round_capacity(size_t capacity)
+	{
+		return capacity;
+	}
+#endif
+
+	static bool is_poisoned(const T *slot)
+	{
+		const unsigned char *bytes = (const unsigned char*) slot;
+		for (size_t i = 0; i < sizeof(T); i++)
+			if (bytes[i] != (unsigned char) POISON)
+				return false;
+
+		return true;
+	}
+};
+
+#ifdef HASH_PROTECTION
+template <typename T, typename Traits>
+unsigned long typed_header_hash(TypedStack<T, Traits> *stk)
+{
+	typedef TypedStack<T, Traits> Header;
+	const unsigned char *header = (const unsigned char*) stk;
+	size_t skip_from = offsetof(Header, ops_since_check);
+	size_t skip_to = skip_from + sizeof(stk->ops_since_check);
+
+	return hash_bytes(header, skip_from) ^
+		   hash_bytes(header + skip_to, sizeof(Header) - skip_to) * 0x9E3779B97F4A7C15UL;
+}
+
+template <typename T, typename Traits>
+void update_header_hash(TypedStack<T, Traits> *stk)
+{
+	unsigned long data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	stk->hash = typed_header_hash(stk);
+	stk->data_hash = data_hash;
+}
+
+template <typename T, typename Traits>
+unsigned long compute_data_hash(TypedStack<T, Traits> *stk)
+{
+	unsigned long hash = 0;
+	for (size_t i = 0; i < stk->capacity; i++)
+		hash += slot_hash(stk->data + i, sizeof(T), i);
+
+	return hash;
+}
+
+template <typename T, typename Traits>
+void update_slot_hash(TypedStack<T, Traits> *stk, size_t index,
+					  unsigned long old_slot_hash)
+{
+	stk->data_hash += slot_hash(stk->data + index, sizeof(T), index) - old_slot_hash;
+	update_header_hash(stk);
+}
+
+template <typename T, typename Traits>
+void update_hash(TypedStack<T, Traits> *stk)
+{
+	stk->data_hash = compute_data_hash(stk);
+	update_header_hash(stk);
+}
+#endif
+
+template <typename T, typename Traits>
+enum StackError validate_stack_header(TypedStack<T, Traits> *stk, int *err)
+{
+	*err = 0;
+
+	if (!stk) {
+		*err |= 1 << NULL_STACK_POINTER;
+		return STACK_FAILED;
+	}
+
+	if (!stk->data)
+		*err |= 1 << NULL_DATA_POINTER;
+
+	if (stk->size > stk->capacity)
+		*err |= 1 << CAPACITY_OVERFLOW;
+
+	if (stk->capacity < INIT_CAPACITY)
+		*err |= 1 << SMALL_CAPACITY;
+
+#ifdef CANARY_PROTECTION
+	if (stk->data && ((canary_t*) stk->data)[-1] != DEFAULT_CANARY)
+		*err |= 1 << LEFT_DATA_CANARY_BAD;
+#endif
+
+#ifdef HASH_PROTECTION
+	unsigned long old_hash = stk->hash;
+	unsigned long old_data_hash = stk->data_hash;
+	stk->hash = 0;
+	stk->data_hash = 0;
+	if (old_hash != typed_header_hash(stk))
+		*err |= 1 << WRONG_HASH;
+	stk->hash = old_hash;
+	stk->data_hash = old_data_hash;
+#endif
+
+#ifdef CANARY_PROTECTION
+	if (stk->left_canary != DEFAULT_CANARY)
+		*err |= 1 << LEFT_CANARY_BAD;
+
+	if (stk->right_canary != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_CANARY_BAD;
+#endif
+
+	if (*err != 0)
+		return STACK_FAILED;
+
+#ifdef CANARY_PROTECTION
+	if (*((canary_t*) (stk->data + stk->capacity)) != DEFAULT_CANARY)
+		*err |= 1 << RIGHT_DATA_CANARY_BAD;
+#endif
+
+	if (stk->size > 0 && Typed_layout<T>::is_poisoned(stk->data + stk->size - 1))
+		*err |= 1 << POISONED_VALUE;
+
+	if (stk->size < stk->capacity && !Typed_layout<T>::is_poisoned(stk->data + stk->size))
+		*err |= 1 << UNPOISONED_VALUE;
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError validate_stack(TypedStack<T, Traits> *stk, int *err)
+{
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+#ifdef HASH_PROTECTION
+	if (stk->data_hash != compute_data_hash(stk))
+		*err |= 1 << WRONG_DATA_HASH;
+#endif
+
+	if (find_poisoned(stk->data, stk->size, sizeof(T)) < stk->size)
+		*err |= 1 << POISONED_VALUE;
+
+	if (find_unpoisoned(stk->data + stk->size, stk->capacity - stk->size, sizeof(T)) <
+		stk->capacity - stk->size)
+		*err |= 1 << UNPOISONED_VALUE;
+
+	if (*err != 0)
+		return STACK_FAILED;
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError validate_stack_op(TypedStack<T, Traits> *stk, int *err)
+{
+	if (!stk || stk->validation == VALIDATE_FULL)
+		return validate_stack(stk, err);
+
+	if (validate_stack_header(stk, err) == STACK_FAILED)
+		return STACK_FAILED;
+
+	switch (stk->validation) {
+		case VALIDATE_HEADER:
+			return STACK_NO_ERR;
+		case VALIDATE_PERIODIC:
+			break;
+		case VALIDATE_FULL:
+		default:
+			return validate_stack(stk, err);
+	}
+
+	bool full_check = ++stk->ops_since_check >= stk->validation_period;
+	if (!full_check)
+		return STACK_NO_ERR;
+
+	stk->ops_since_check = 0;
+	return validate_stack(stk, err);
+}
+
+template <typename T, typename Traits>
+void stack_dump(TypedStack<T, Traits> *stk)
+{
+	if (!LOG_ENABLED(DEBUG)) return;
+
+	const size_t POISONED_MAX = 20;
+	log_message(DEBUG, "Stack [%p]\n", stk);
+
+	if (!stk) return;
+
+	log_string(DEBUG, "\t\"%s\" from %s (%d) %s()\n", stk->varname, stk->filename,
+			   stk->line, stk->funcname);
+	log_string(DEBUG, "\t{\n\t\tsize = %lu\n"
+			   "\t\tcapacity = %lu\n",
+			   stk->size, stk->capacity);
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\tleft canary = 0x%llX\n", stk->left_canary);
+	log_string(DEBUG, "\t\tright canary = 0x%llX\n", stk->right_canary);
+#endif
+
+#ifdef HASH_PROTECTION
+	log_string(DEBUG, "\t\thash = 0x%lX\n", stk->hash);
+	log_string(DEBUG, "\t\tdata hash = 0x%lX\n", stk->data_hash);
+#endif
+
+	log_string(DEBUG, "\t\tdata [%p]\n", stk->data);
+
+	if (!stk->data) {
+		log_string(DEBUG, "\t}\n");
+		return;
+	}
+
+	log_string(DEBUG, "\t\t{\n");
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\t\tleft canary = 0x%llX\n", ((canary_t*) stk->data)[-1]);
+
+	if (stk->left_canary != DEFAULT_CANARY || stk->right_canary != DEFAULT_CANARY) {
+		log_string(DEBUG, "\t\t}\n\t}\n");
+		return;
+	}
+#endif
+
+	const size_t BUFF_SIZE = 1024;
+	char buffer[BUFF_SIZE] = {};
+	for (size_t i = 0; i < stk->capacity && i < stk->size + POISONED_MAX; i++) {
+		bool is_poisoned = Typed_layout<T>::is_poisoned(stk->data + i);
+		if (!std::is_trivially_copyable<T>::value && (is_poisoned || i >= stk->size))
+			print_bytes(buffer, stk->data + i, sizeof(T), BUFF_SIZE);
+		else
+			Traits::print(buffer, stk->data[i], BUFF_SIZE);
+
+		log_string(DEBUG, i < stk->size ? "\t\t\t*[%lu] = " : "\t\t\t[%lu] = ", i);
+		log_string(DEBUG, "%s", buffer);
+		if (is_poisoned)
+			log_string(DEBUG, " (poison)");
+		log_string(DEBUG, "\n");
+	}
+
+#ifdef CANARY_PROTECTION
+	log_string(DEBUG, "\t\t\tright canary = 0x%llX\n",
+			   *((canary_t*) (stk->data + stk->capacity)));
+#endif
+
+	log_string(DEBUG, "\t\t}\n\t}\n");
+}
+
+template <typename T, typename Traits>
+void stack_report_fail(TypedStack<T, Traits> *stk, int err,
+					   const char *filename, int line, const char *func_name)
+{
+	log_stack_failures(err, filename, line, func_name);
+	stack_dump(stk);
+	logger_flush();
+}
+
+template <typename T, typename Traits>
+enum StackError reallocate_stack(TypedStack<T, Traits> *stk, size_t new_size)
+{
+	VALIDATE_STACK(stk);
+
+	new_size = Typed_layout<T>::round_capacity(new_size);
+	if (new_size == stk->capacity)
+		return STACK_NO_ERR;
+
+	log_message(DEBUG, "reallocated stack from %lu to %lu\n", stk->capacity, new_size);
+
+	unsigned char *old_mem = (unsigned char*) stk->data - Typed_layout<T>::DATA_OFFSET;
+	unsigned char *mem = NULL;
+
+	if (std::is_trivially_copyable<T>::value) {
+		mem = (unsigned char*) realloc(old_mem, new_size * sizeof(T) +
+									   Typed_layout<T>::CANARIES_SIZE);
+		if (!mem) return ERR_NO_MEM;
+	} else {
+		mem = (unsigned char*) calloc(new_size * sizeof(T) + Typed_layout<T>::CANARIES_SIZE,
+									  sizeof(char));
+		if (!mem) return ERR_NO_MEM;
+
+		T *new_data = (T*) (mem + Typed_layout<T>::DATA_OFFSET);
+		for (size_t i = 0; i < stk->size; i++) {
+			new (new_data + i) T(std::move(stk->data[i]));
+			stk->data[i].~T();
+		}
+
+		memcpy(mem, old_mem, Typed_layout<T>::DATA_OFFSET);
+		free(old_mem);
+	}
+
+	stk->data = (T*) (mem + Typed_layout<T>::DATA_OFFSET);
+	if (new_size > stk->size)
+		memset((void*) (stk->data + stk->size), POISON, (new_size - stk->size) * sizeof(T));
+	stk->capacity = new_size;
+
+#ifdef CANARY_PROTECTION
+	*((canary_t*) (stk->data + stk->capacity)) = DEFAULT_CANARY;
+#endif
+
+#ifdef HASH_PROTECTION
+	update_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError stack_ctor(TypedStack<T, Traits> *stk, const char *varname, int line,
+						   const char *filename, const char *funcname)
+{
+	int err = {};
+	if (!stk) {
+		err |= 1 << NULL_STACK_POINTER;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	if (stk->data || stk->capacity != 0 || stk->size != 0) {
+		err |= 1 << DOUBLE_CTOR;
+		STACK_REPORT_FAIL(stk, err);
+		abort();
+	}
+
+	stk->size = 0;
+	stk->capacity = Typed_layout<T>::round_capacity(INIT_CAPACITY);
+
+	unsigned char *mem = (unsigned char*) calloc(stk->capacity * sizeof(T) +
+												 Typed_layout<T>::CANARIES_SIZE,
+												 sizeof(char));
+	if (mem == NULL) return ERR_NO_MEM;
+	stk->data = (T*) (mem + Typed_layout<T>::DATA_OFFSET);
+
+	memset((void*) stk->data, POISON, stk->capacity * sizeof(T));
+
+	stk->filename = filename;
+	stk->line = line;
+	stk->varname = varname;
+	stk->funcname = funcname;
+
+	default_validation(&stk->validation, &stk->validation_period);
+	stk->ops_since_check = 0;
+
+#ifdef CANARY_PROTECTION
+	stk->left_canary = DEFAULT_CANARY;
+	stk->right_canary = DEFAULT_CANARY;
+	((canary_t*) stk->data)[-1] = DEFAULT_CANARY;
+	*((canary_t*) (stk->data + stk->capacity)) = DEFAULT_CANARY;
+#endif
+
+#ifdef HASH_PROTECTION
+	update_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError stack_dtor(TypedStack<T, Traits> *stk)
+{
+	VALIDATE_STACK_FULL(stk);
+
+	for (size_t i = 0; i < stk->size; i++)
+		stk->data[i].~T();
+
+	free((unsigned char*) stk->data - Typed_layout<T>::DATA_OFFSET);
+
+	stk->size = 0;
+	stk->capacity = 0;
+	stk->data = NULL;
+
+#ifdef CANARY_PROTECTION
+	stk->right_canary = 0;
+	stk->left_canary = 0;
+#endif
+
+#ifdef HASH_PROTECTION
+	stk->hash = 0;
+	stk->data_hash = 0;
+#endif
+
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError stack_push(TypedStack<T, Traits> *stk, T value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == stk->capacity) {
+		enum StackError error = reallocate_stack(stk, stk->capacity * MULTIPLIER);
+		if (error < 0) return error;
+	}
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = slot_hash(stk->data + stk->size, sizeof(T), stk->size);
+#endif
+
+	size_t index = stk->size++;
+	new (stk->data + index) T(std::move(value));
+
+#ifdef HASH_PROTECTION
+	update_slot_hash(stk, index, old_slot_hash);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError stack_pop(TypedStack<T, Traits> *stk, T *value)
+{
+	VALIDATE_STACK(stk);
+
+	if (stk->size == 0) return ERR_STACK_EMPTY;
+
+	size_t index = --stk->size;
+
+#ifdef HASH_PROTECTION
+	unsigned long old_slot_hash = slot_hash(stk->data + index, sizeof(T), index);
+#endif
+
+	*value = std::move(stk->data[index]);
+	stk->data[index].~T();
+	memset((void*) (stk->data + index), POISON, sizeof(T));
+
+#ifdef HASH_PROTECTION
+	update_slot_hash(stk, index, old_slot_hash);
+#endif
+
+	// a failed shrink only leaves the bigger buffer in place, the pop itself is done
+	if (stk->size * SHRINK_COEF <= stk->capacity && stk->capacity > INIT_CAPACITY)
+		reallocate_stack(stk, stk->capacity / MULTIPLIER);
+
+	return STACK_NO_ERR;
+}
+
+template <typename T, typename Traits>
+enum StackError stack_set_validation(TypedStack<T, Traits> *stk, enum ValidationLevel level,
+									 size_t period)
+{
+	VALIDATE_STACK_FULL(stk);
+
+	stk->validation = level;
+	stk->validation_period = period > 0 ? period : 1;
+	stk->ops_since_check = 0;
+
+#ifdef HASH_PROTECTION
+	update_header_hash(stk);
+#endif
+
+	return STACK_NO_ERR;
+}
+
+#endif
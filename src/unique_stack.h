@@ -0,0 +1,169 @@
+#ifndef UNIQUE_STACK
+#define UNIQUE_STACK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+
+#include "logger.h"
+#include "stack.h"
+#include "stack_debug.h"
+
+inline int print_unique_elem(char *buffer, elem_t value, size_t n)
+{
+	return snprintf(buffer, n, "cost: %.2lf; amount: %d", value.cost, value.amount);
+}
+
+/*
+* Owning handle for a Stack. It can't be copied; moves hand the header over
+* with stack_move, so a std::vector<UniqueStack> never touches element buffers
+* when it grows. Elements are read in place through top() and iteration, while
+* writes go through push/emplace/pop so that canaries, hashes and the journal
+* stay in sync. Operations return StackError like the C API; the constructor
+* throws std::bad_alloc, having no other way to report ERR_NO_MEM. Using a
+* moved-from handle fails validation like any destroyed stack.
+*/
+class UniqueStack {
+public:
+	explicit UniqueStack(const struct Stack_allocator *allocator = NULL,
+						 print_func print_elem = print_unique_elem,
+						 const char *filename = __builtin_FILE(), int line = __builtin_LINE(),
+						 const char *funcname = __builtin_FUNCTION())
+		: stk()
+	{
+		if (stack_ctor(&stk, print_elem, allocator, "UniqueStack", line, filename,
+					   funcname) != STACK_NO_ERR)
+			throw std::bad_alloc();
+	}
+
+	// takes over a stack built by the C API, e.g. with STACK_LOAD or STACK_OPEN
+	explicit UniqueStack(struct Stack *src)
+		: stk()
+	{
+		stack_move(&stk, src);
+	}
+
+	UniqueStack(const UniqueStack &other) = delete;
+	UniqueStack &operator=(const UniqueStack &other) = delete;
+
+	UniqueStack(UniqueStack &&other) noexcept
+		: stk()
+	{
+		if (other.stk.data != NULL)
+			stack_move(&stk, &other.stk);
+	}
+
+	UniqueStack &operator=(UniqueStack &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			if (other.stk.data != NULL)
+				stack_move(&stk, &other.stk);
+		}
+
+		return *this;
+	}
+
+	~UniqueStack()
+	{
+		reset();
+	}
+
+	// elem_t is trivially copyable, so building it here costs one store into the slot
+	template <typename... Args>
+	enum StackError emplace(Args&&... args)
+	{
+		return stack_push(&stk, elem_t{std::forward<Args>(args)...});
+	}
+
+	enum StackError push(const elem_t &value)
+	{
+		return stack_push(&stk, value);
+	}
+
+	enum StackError pop()
+	{
+		return stack_pop_n(&stk, NULL, 1);
+	}
+
+	const elem_t &top() const
+	{
+		if (stk.size == 0 || stk.data == NULL) {
+			log_message(ERROR, "top() of an empty stack [%p]\n", &stk);
+			logger_flush();
+			abort();
+		}
+
+		return stk.data[stk.size - 1];
+	}
+
+	const elem_t *begin() const
+	{
+		return stk.data;
+	}
+
+	const elem_t *end() const
+	{
+		return stk.data + stk.size;
+	}
+
+	bool empty() const
+	{
+		return stk.size == 0;
+	}
+
+	size_t size() const
+	{
+		return stk.size;
+	}
+
+	size_t capacity() const
+	{
+		return stk.capacity;
+	}
+
+	enum StackError reserve(size_t capacity)
+	{
+		return stack_reserve(&stk, capacity);
+	}
+
+	enum StackError shrink_to_fit()
+	{
+		return stack_shrink_to_fit(&stk);
+	}
+
+	// not begin(): that name is taken by iteration
+	enum StackError begin_transaction()
+	{
+		return stack_begin(&stk);
+	}
+
+	enum StackError commit()
+	{
+		return stack_commit(&stk);
+	}
+
+	enum StackError rollback()
+	{
+		return stack_rollback(&stk);
+	}
+
+	// for the rest of the C API: dumps, stats, policies, snapshots
+	struct Stack *get()
+	{
+		return &stk;
+	}
+
+	// destroys the stack, leaving an empty handle
+	void reset()
+	{
+		if (stk.data != NULL)
+			stack_dtor(&stk);
+	}
+
+private:
+	struct Stack stk;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+
+#include "ws_deque.h"
+
+struct Ws_array *ws_array_ctor(size_t capacity, struct Ws_array *retired);
+void resize_deque(struct WsDeque *deque, long top, long bottom, size_t new_capacity);
+
+struct Ws_array *ws_array_ctor(size_t capacity, struct Ws_array *retired)
+{
+	struct Ws_array *array = (struct Ws_array*) calloc(1, sizeof(Ws_array));
+	if (array == NULL) return NULL;
+
+	array->slots = (std::atomic<void*>*) calloc(capacity, sizeof(std::atomic<void*>));
+	if (array->slots == NULL) {
+		free(array);
+		return NULL;
+	}
+
+	array->capacity = capacity;
+	array->retired = retired;
+
+	return array;
+}
+
+// only called by the owner; on allocation failure the deque keeps its old buffer
+void resize_deque(struct WsDeque *deque, long top, long bottom, size_t new_capacity)
+{
+	struct Ws_array *old_array = deque->array.load(std::memory_order_relaxed);
+	struct Ws_array *new_array = ws_array_ctor(new_capacity, old_array);
+	if (new_array == NULL) return;
+
+	for (long i = top; i < bottom; i++) {
+		void *value = old_array->slots[(size_t) i % old_array->capacity].load(
+															std::memory_order_relaxed);
+		new_array->slots[(size_t) i % new_capacity].store(value, std::memory_order_relaxed);
+	}
+
+	deque->array.store(new_array, std::memory_order_release);
+}
+
+enum StackError ws_deque_ctor(struct WsDeque *deque)
+{
+	if (!deque) return STACK_FAILED;
+
+	if (deque->array.load() != NULL) return STACK_FAILED;
+
+	struct Ws_array *array = ws_array_ctor(WS_INIT_CAPACITY, NULL);
+	if (array == NULL) return ERR_NO_MEM;
+
+	deque->top.store(0);
+	deque->bottom.store(0);
+	deque->array.store(array);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError ws_deque_dtor(struct WsDeque *deque)
+{
+	if (!deque) return STACK_FAILED;
+
+	struct Ws_array *array = deque->array.load();
+	while (array != NULL) {
+		struct Ws_array *retired = array->retired;
+		free(array->slots);
+		free(array);
+		array = retired;
+	}
+
+	deque->array.store(NULL);
+	deque->top.store(0);
+	deque->bottom.store(0);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError ws_deque_push(struct WsDeque *deque, void *value)
+{
+	long bottom = deque->bottom.load(std::memory_order_relaxed);
+	long top = deque->top.load(std::memory_order_acquire);
+	struct Ws_array *array = deque->array.load(std::memory_order_relaxed);
+
+	if ((size_t) (bottom - top) >= array->capacity) {
+		resize_deque(deque, top, bottom, array->capacity * MULTIPLIER);
+
+		array = deque->array.load(std::memory_order_relaxed);
+		if ((size_t) (bottom - top) >= array->capacity)
+			return ERR_NO_MEM;
+	}
+
+	array->slots[(size_t) bottom % array->capacity].store(value, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+
+	return STACK_NO_ERR;
+}
+
+enum StackError ws_deque_pop(struct WsDeque *deque, void **value)
+{
+	long bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+	struct Ws_array *array = deque->array.load(std::memory_order_relaxed);
+	deque->bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long top = deque->top.load(std::memory_order_relaxed);
+
+	if (top > bottom) {
+		deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+		return ERR_STACK_EMPTY;
+	}
+
+	*value = array->slots[(size_t) bottom % array->capacity].load(std::memory_order_relaxed);
+
+	if (top == bottom) {
+		bool is_won = deque->top.compare_exchange_strong(top, top + 1,
+														 std::memory_order_seq_cst,
+														 std::memory_order_relaxed);
+		deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+		return is_won ? STACK_NO_ERR : ERR_STACK_EMPTY;
+	}
+
+	return STACK_NO_ERR;
+}
+
+enum StackError ws_deque_steal(struct WsDeque *deque, void **value)
+{
+	long top = deque->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long bottom = deque->bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+		return ERR_STACK_EMPTY;
+
+	struct Ws_array *array = deque->array.load(std::memory_order_acquire);
+	void *stolen = array->slots[(size_t) top % array->capacity].load(std::memory_order_relaxed);
+
+	if (!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+											std::memory_order_relaxed))
+		return ERR_STEAL_LOST;
+
+	*value = stolen;
+	return STACK_NO_ERR;
+}
+
+size_t ws_deque_size(struct WsDeque *deque)
+{
+	long size = deque->bottom.load(std::memory_order_relaxed) -
+				deque->top.load(std::memory_order_relaxed);
+
+	return size > 0 ? (size_t) size : 0;
+}
@@ -0,0 +1,36 @@
+#ifndef WS_DEQUE
+#define WS_DEQUE
+
+#include <atomic>
+
+#include "stack.h"
+
+const size_t WS_INIT_CAPACITY = 64;
+
+struct Ws_array {
+	size_t capacity;
+	struct Ws_array *retired;
+	std::atomic<void*> *slots;
+};
+
+/*
+* Chase-Lev work-stealing deque. The owner thread pushes and pops at the
+* bottom, other threads steal from the top. The buffer grows by MULTIPLIER
+* like reallocate_stack does, but never shrinks: replaced buffers may still
+* be read by thieves, so they are kept on the retired list until the
+* destructor, and growing only bounds them by the current buffer size.
+*/
+struct WsDeque {
+	std::atomic<long> top;
+	std::atomic<long> bottom;
+	std::atomic<struct Ws_array*> array;
+};
+
+enum StackError ws_deque_ctor(struct WsDeque *deque);
+enum StackError ws_deque_dtor(struct WsDeque *deque);
+enum StackError ws_deque_push(struct WsDeque *deque, void *value);
+enum StackError ws_deque_pop(struct WsDeque *deque, void **value);
+enum StackError ws_deque_steal(struct WsDeque *deque, void **value);
+size_t ws_deque_size(struct WsDeque *deque);
+
+#endif
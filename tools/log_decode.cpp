@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logger.h"
+
+const size_t SPEC_SIZE = 64;
+
+struct Log_reader {
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+};
+
+unsigned char *read_file(const char *filename, size_t *size);
+bool read_bytes(struct Log_reader *reader, void *dest, size_t size);
+bool skip_bytes(struct Log_reader *reader, size_t size);
+bool collect_formats(struct Log_reader reader, const char **formats, uint32_t *lengths);
+void render_event(const char *format, const unsigned char *args, size_t args_size);
+void render_spec(const struct Log_spec *spec, const unsigned char *args, size_t *pos,
+				 size_t args_size);
+template <typename T>
+void print_value(const char *spec_str, int num_stars, const int *stars, T value);
+
+unsigned char *read_file(const char *filename, size_t *size)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) return NULL;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length < 0) {
+		fclose(file);
+		return NULL;
+	}
+
+	unsigned char *data = (unsigned char*) malloc((size_t) length + 1);
+	if (data != NULL)
+		*size = fread(data, 1, (size_t) length, file);
+
+	fclose(file);
+	return data;
+}
+
+bool read_bytes(struct Log_reader *reader, void *dest, size_t size)
+{
+	if (reader->size - reader->pos < size) return false;
+
+	memcpy(dest, reader->data + reader->pos, size);
+	reader->pos += size;
+	return true;
+}
+
+bool skip_bytes(struct Log_reader *reader, size_t size)
+{
+	if (reader->size - reader->pos < size) return false;
+
+	reader->pos += size;
+	return true;
+}
+
+// first pass: formats may be defined after an event from another thread uses them
+bool collect_formats(struct Log_reader reader, const char **formats, uint32_t *lengths)
+{
+	unsigned char type = 0;
+	while (read_bytes(&reader, &type, sizeof(type))) {
+		uint32_t id = 0;
+		uint32_t length = 0;
+
+		if (type == LOG_REC_FORMAT) {
+			if (!read_bytes(&reader, &id, sizeof(id)) ||
+				!read_bytes(&reader, &length, sizeof(length)) ||
+				reader.size - reader.pos < length || id == 0 || id > LOG_MAX_FORMATS)
+				return false;
+
+			formats[id - 1] = (const char*) reader.data + reader.pos;
+			lengths[id - 1] = length;
+			reader.pos += length;
+		}
+		else if (type == LOG_REC_EVENT) {
+			unsigned char prefix_size = 0;
+			uint32_t args_size = 0;
+
+			if (!skip_bytes(&reader, sizeof(id) + 1) ||
+				!read_bytes(&reader, &prefix_size, sizeof(prefix_size)) ||
+				!skip_bytes(&reader, prefix_size + sizeof(uint64_t)) ||
+				!read_bytes(&reader, &args_size, sizeof(args_size)) ||
+				!skip_bytes(&reader, args_size))
+				return false;
+		}
+		else
+			return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+void print_value(const char *spec_str, int num_stars, const int *stars, T value)
+{
+	switch (num_stars) {
+		case 0:
+			printf(spec_str, value);
+			break;
+		case 1:
+			printf(spec_str, stars[0], value);
+			break;
+		default:
+			printf(spec_str, stars[0], stars[1], value);
+	}
+}
+
+// long integer conversions are rewritten to take long long and floating ones to
+// take double; int-sized ones keep their h/hh and take int or unsigned, so the
+// sign-extended value is cut back to what the caller passed
+void render_spec(const struct Log_spec *spec, const unsigned char *args, size_t *pos,
+				 size_t args_size)
+{
+	int stars[2] = {};
+	for (int i = 0; i < spec->num_stars && i < 2; i++) {
+		int64_t star = 0;
+		if (*pos + sizeof(star) > args_size) return;
+		memcpy(&star, args + *pos, sizeof(star));
+		*pos += sizeof(star);
+		stars[i] = (int) star;
+	}
+
+	char spec_str[SPEC_SIZE] = "";
+	size_t length = 0;
+	for (const char *cur = spec->begin; cur < spec->end - 1 && length < SPEC_SIZE - 4; cur++)
+		if (spec->kind == LOG_ARG_INT || !strchr("hlqLjzt", *cur))
+			spec_str[length++] = *cur;
+
+	if (spec->kind == LOG_ARG_LONG) {
+		spec_str[length++] = 'l';
+		spec_str[length++] = 'l';
+	}
+	spec_str[length] = spec->end[-1];
+	bool is_unsigned = strchr("uoxX", spec->end[-1]) != NULL;
+
+	if (spec->kind == LOG_ARG_NONE) {
+		fputc(spec->end[-1], stdout);
+		return;
+	}
+
+	if (spec->kind == LOG_ARG_SKIP)
+		return;
+
+	int64_t integer = 0;
+	double real = 0;
+	char *string = NULL;
+
+	if (spec->kind == LOG_ARG_STRING) {
+		uint32_t string_size = 0;
+		if (*pos + sizeof(string_size) > args_size) return;
+		memcpy(&string_size, args + *pos, sizeof(string_size));
+		*pos += sizeof(string_size);
+		if (*pos + string_size > args_size) return;
+
+		// the stored string isn't terminated
+		string = strndup((const char*) args + *pos, string_size);
+		*pos += string_size;
+		if (string == NULL) return;
+	}
+	else {
+		if (*pos + sizeof(integer) > args_size) return;
+		memcpy(&integer, args + *pos, sizeof(integer));
+		memcpy(&real, args + *pos, sizeof(real));
+		*pos += sizeof(integer);
+	}
+
+	switch (spec->kind) {
+		case LOG_ARG_DOUBLE:
+		case LOG_ARG_LONG_DOUBLE:
+			print_value(spec_str, spec->num_stars, stars, real);
+			break;
+		case LOG_ARG_STRING:
+			print_value(spec_str, spec->num_stars, stars, (const char*) string);
+			break;
+		case LOG_ARG_POINTER:
+			print_value(spec_str, spec->num_stars, stars, (void*) (uintptr_t) integer);
+			break;
+		case LOG_ARG_INT:
+			if (is_unsigned)
+				print_value(spec_str, spec->num_stars, stars, (unsigned) integer);
+			else
+				print_value(spec_str, spec->num_stars, stars, (int) integer);
+			break;
+		case LOG_ARG_LONG:
+			if (is_unsigned)
+				print_value(spec_str, spec->num_stars, stars, (unsigned long long) integer);
+			else
+				print_value(spec_str, spec->num_stars, stars, (long long) integer);
+			break;
+		case LOG_ARG_NONE:
+		case LOG_ARG_SKIP:
+		default:
+			print_value(spec_str, spec->num_stars, stars, (long long) integer);
+	}
+
+	free(string);
+}
+
+void render_event(const char *format, const unsigned char *args, size_t args_size)
+{
+	size_t pos = 0;
+	struct Log_spec spec = {};
+
+	for (; log_next_spec(format, &spec); format = spec.end) {
+		fwrite(format, 1, (size_t) (spec.begin - format), stdout);
+		render_spec(&spec, args, &pos, args_size);
+	}
+
+	fputs(format, stdout);
+}
+
+int main(int argc, const char *argv[])
+{
+	bool show_time = argc > 2 && strcmp(argv[1], "-t") == 0;
+	if (argc < 2 || (argc > 2 && !show_time)) {
+		fprintf(stderr, "usage: %s [-t] binary_log\n", argv[0]);
+		return 1;
+	}
+
+	size_t size = 0;
+	unsigned char *data = read_file(argv[argc - 1], &size);
+	if (data == NULL) {
+		fprintf(stderr, "can't read %s\n", argv[argc - 1]);
+		return 1;
+	}
+
+	size_t magic_size = sizeof(LOG_BINARY_MAGIC) - 1;
+	if (size < magic_size || memcmp(data, LOG_BINARY_MAGIC, magic_size) != 0) {
+		fprintf(stderr, "%s is not a binary log\n", argv[argc - 1]);
+		free(data);
+		return 1;
+	}
+
+	struct Log_reader reader = { data, size, magic_size };
+
+	const char **formats = (const char**) calloc(LOG_MAX_FORMATS, sizeof(const char*));
+	uint32_t *lengths = (uint32_t*) calloc(LOG_MAX_FORMATS, sizeof(uint32_t));
+	if (formats == NULL || lengths == NULL) {
+		free(formats);
+		free(lengths);
+		free(data);
+		return 1;
+	}
+
+	if (!collect_formats(reader, formats, lengths))
+		fprintf(stderr, "warning: the log is truncated or corrupted\n");
+
+	printf("\tSTART OF LOG\n-----------------------------\n\n");
+
+	unsigned char type = 0;
+	while (read_bytes(&reader, &type, sizeof(type))) {
+		uint32_t id = 0;
+		uint32_t length = 0;
+
+		if (type == LOG_REC_FORMAT) {
+			if (!read_bytes(&reader, &id, sizeof(id)) ||
+				!read_bytes(&reader, &length, sizeof(length)) || !skip_bytes(&reader, length))
+				break;
+			continue;
+		}
+
+		if (type != LOG_REC_EVENT)
+			break;
+
+		unsigned char prefix_size = 0;
+		uint64_t timestamp = 0;
+		uint32_t args_size = 0;
+
+		if (!read_bytes(&reader, &id, sizeof(id)) ||
+			!skip_bytes(&reader, 1) ||
+			!read_bytes(&reader, &prefix_size, sizeof(prefix_size)))
+			break;
+
+		const char *prefix = (const char*) data + reader.pos;
+		if (!skip_bytes(&reader, prefix_size) ||
+			!read_bytes(&reader, &timestamp, sizeof(timestamp)) ||
+			!read_bytes(&reader, &args_size, sizeof(args_size)))
+			break;
+
+		const unsigned char *args = data + reader.pos;
+		if (!skip_bytes(&reader, args_size))
+			break;
+
+		if (show_time)
+			printf("[%llu.%09llu] ", (unsigned long long) (timestamp / 1000000000),
+				   (unsigned long long) (timestamp % 1000000000));
+
+		printf("%.*s ", (int) prefix_size, prefix);
+
+		if (id == 0) {
+			if (args_size >= sizeof(length)) {
+				memcpy(&length, args, sizeof(length));
+				if (length <= args_size - sizeof(length))
+					fwrite(args + sizeof(length), 1, length, stdout);
+			}
+		}
+		else if (id <= LOG_MAX_FORMATS && formats[id - 1] != NULL) {
+			// the format bytes in the file aren't terminated
+			char *format = strndup(formats[id - 1], lengths[id - 1]);
+			if (format != NULL)
+				render_event(format, args, args_size);
+			free(format);
+		}
+		else
+			printf("<unknown format %u>\n", id);
+	}
+
+	printf("\n-----------------------------\n\tEND OF LOG\n");
+
+	free(formats);
+	free(lengths);
+	free(data);
+	return 0;
+}